@@ -0,0 +1,82 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "const.hpp"
+#include "gamestate.hpp"
+
+
+// What a brain wants to do on its turn, according to its outputs.
+struct Action
+{
+	size_t tableCard = 0;
+	float tableCardWeight = 0;
+	size_t ownCard = 0;
+	float ownCardWeight = 0;
+	float passWeight = 0;
+	bool swapOnPass = false;
+
+	bool isMove() const
+	{
+		return tableCardWeight > passWeight && ownCardWeight > passWeight;
+	}
+
+	bool operator==(const Action& other) const
+	{
+		if (isMove() != other.isMove()) return false;
+		if (isMove())
+		{
+			return tableCard == other.tableCard && ownCard == other.ownCard;
+		}
+		return swapOnPass == other.swapOnPass;
+	}
+};
+
+// Picks the best legal move from a row of ACTION_SIZE outputs.
+inline Action decodeAction(const float* output, uint64_t table, uint64_t hand)
+{
+	Action action;
+	action.passWeight = output[2 * NUM_CARDS];
+	if (output[2 * NUM_CARDS + 1] > action.passWeight)
+	{
+		action.swapOnPass = true;
+		action.passWeight = output[2 * NUM_CARDS + 1];
+	}
+	action.tableCardWeight = action.passWeight - 1;
+	action.ownCardWeight = action.passWeight - 1;
+	for (uint64_t cards = table; cards != 0; )
+	{
+		size_t c = popLowestCard(cards);
+		if (output[c] > action.tableCardWeight)
+		{
+			action.tableCard = c;
+			action.tableCardWeight = output[c];
+		}
+	}
+	for (uint64_t cards = hand; cards != 0; )
+	{
+		size_t c = popLowestCard(cards);
+		if (output[NUM_CARDS + c] > action.ownCardWeight)
+		{
+			action.ownCard = c;
+			action.ownCardWeight = output[NUM_CARDS + c];
+		}
+	}
+	return action;
+}
+
+// The cards in one set of a view, which starts with the table
+// and then the hand of the player whose view it is.
+inline uint64_t cardsInView(const float* viewSet)
+{
+	uint64_t cards = 0;
+	for (size_t c = 0; c < NUM_CARDS; c++)
+	{
+		if (viewSet[c] > 0)
+		{
+			cards |= cardBit(c);
+		}
+	}
+	return cards;
+}
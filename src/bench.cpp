@@ -0,0 +1,209 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#ifdef _MSC_VER
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#endif
+
+#include "settings.hpp"
+#include "trainer.hpp"
+
+// Runs a fixed number of rounds without asking anything, and reports
+// throughput and where the time went as JSON, optionally comparing it
+// against a baseline from an earlier run.
+
+
+static void writeMetrics(std::ostream& out, const RoundMetrics& metrics)
+{
+	out << "\"totalMs\": " << metrics.totalMs << ", "
+		"\"dealMs\": " << metrics.dealMs << ", "
+		"\"viewMs\": " << metrics.viewMs << ", "
+		"\"evaluateMs\": " << metrics.evaluateMs << ", "
+		"\"updateMs\": " << metrics.updateMs << ", "
+		"\"tallyMs\": " << metrics.tallyMs << ", "
+		"\"sortMs\": " << metrics.sortMs << ", "
+		"\"evolveMs\": " << metrics.evolveMs << ", "
+		"\"saveMs\": " << metrics.saveMs;
+}
+
+// Finds a number in the flat top level of a JSON file written by this bench.
+static bool readNumber(const std::string& json, const std::string& key,
+	double& value)
+{
+	size_t pos = json.find("\"" + key + "\":");
+	if (pos == std::string::npos)
+	{
+		return false;
+	}
+	std::stringstream strm(json.substr(pos + key.size() + 3));
+	return bool(strm >> value);
+}
+
+int run(int argc, char* argv[])
+{
+	size_t numRounds = 3;
+	std::string jsonFilename = "bench.json";
+	std::string baselineFilename;
+	double tolerance = 0.05;
+
+	// Everything the bench does not know is passed on to the trainer.
+	std::vector<char*> trainerArgs = { argv[0] };
+	Settings defaults;
+	defaults.fixedSeed = true;
+	defaults.seed = 1;
+	defaults.numGamesPerBrain = 100;
+	defaults.outputFolder = "bench_output";
+	for (int i = 1; i < argc; i++)
+	{
+		std::string arg = argv[i];
+		if (arg == "--rounds" && i + 1 < argc)
+		{
+			numRounds = strtoul(argv[++i], nullptr, 10);
+		}
+		else if (arg == "--json" && i + 1 < argc)
+		{
+			jsonFilename = argv[++i];
+		}
+		else if (arg == "--baseline" && i + 1 < argc)
+		{
+			baselineFilename = argv[++i];
+		}
+		else if (arg == "--tolerance" && i + 1 < argc)
+		{
+			tolerance = strtod(argv[++i], nullptr);
+		}
+		else
+		{
+			trainerArgs.push_back(argv[i]);
+		}
+	}
+	Settings settings = Settings::parse(int(trainerArgs.size()),
+		trainerArgs.data());
+	if (!settings.fixedSeed)
+	{
+		settings.fixedSeed = defaults.fixedSeed;
+		settings.seed = defaults.seed;
+	}
+	if (settings.numGamesPerBrain == Settings().numGamesPerBrain)
+	{
+		settings.numGamesPerBrain = defaults.numGamesPerBrain;
+	}
+	if (settings.outputFolder == Settings().outputFolder)
+	{
+		settings.outputFolder = defaults.outputFolder;
+	}
+	if (numRounds == 0)
+	{
+		std::cerr << "Need at least one round" << std::endl;
+		return 1;
+	}
+	// The first round always calculates the correlation and saves the brains,
+	// which the other rounds do not, so it is played but not measured.
+	settings.lastRound = numRounds;
+
+#ifdef _MSC_VER
+	_mkdir(settings.outputFolder.c_str());
+#else
+	mkdir(settings.outputFolder.c_str(), S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH);
+#endif
+
+	Trainer trainer(settings);
+	trainer.train();
+
+	RoundMetrics total;
+	size_t numMeasuredRounds = 0;
+	for (const RoundMetrics& metrics : trainer.metricsPerRound())
+	{
+		if (metrics.saved)
+		{
+			continue;
+		}
+		numMeasuredRounds++;
+		total.numGames += metrics.numGames;
+		total.numForwardRows += metrics.numForwardRows;
+		total.totalMs += metrics.totalMs;
+		total.dealMs += metrics.dealMs;
+		total.viewMs += metrics.viewMs;
+		total.evaluateMs += metrics.evaluateMs;
+		total.updateMs += metrics.updateMs;
+		total.tallyMs += metrics.tallyMs;
+		total.sortMs += metrics.sortMs;
+		total.evolveMs += metrics.evolveMs;
+		total.saveMs += metrics.saveMs;
+	}
+	double seconds = total.totalMs / 1000;
+	double gamesPerSecond = (seconds > 0) ? (total.numGames / seconds) : 0;
+	double rowsPerSecond = (seconds > 0) ? (total.numForwardRows / seconds) : 0;
+
+	std::stringstream json;
+	json << "{" << std::endl;
+	json << "\"seed\": " << settings.seed << "," << std::endl;
+	json << "\"numRounds\": " << numRounds << "," << std::endl;
+	json << "\"numMeasuredRounds\": " << numMeasuredRounds << "," << std::endl;
+	json << "\"numBrainsPerPersonality\": " << NUM_BRAINS_PER_PERSONALITY << ","
+		<< std::endl;
+	json << "\"numGamesPerBrain\": " << settings.numGamesPerBrain << ","
+		<< std::endl;
+	json << "\"gamesPerSecond\": " << gamesPerSecond << "," << std::endl;
+	json << "\"forwardRowsPerSecond\": " << rowsPerSecond << "," << std::endl;
+	json << "\"total\": {";
+	writeMetrics(json, total);
+	json << "}," << std::endl;
+	json << "\"rounds\": [" << std::endl;
+	for (size_t r = 0; r < trainer.metricsPerRound().size(); r++)
+	{
+		const RoundMetrics& metrics = trainer.metricsPerRound()[r];
+		json << "\t" << toJson(metrics) << ""
+			"" << ((r + 1 < trainer.metricsPerRound().size()) ? "," : "")
+			<< std::endl;
+	}
+	json << "]" << std::endl;
+	json << "}" << std::endl;
+
+	std::ofstream file(jsonFilename);
+	file << json.str();
+	std::cout << json.str();
+
+	if (baselineFilename.empty())
+	{
+		return 0;
+	}
+	std::ifstream baselineFile(baselineFilename);
+	if (!baselineFile)
+	{
+		std::cerr << "Failed to open " << baselineFilename << std::endl;
+		return 1;
+	}
+	std::stringstream baseline;
+	baseline << baselineFile.rdbuf();
+	int result = 0;
+	for (const auto& [key, value] : {
+			std::make_pair("gamesPerSecond", gamesPerSecond),
+			std::make_pair("forwardRowsPerSecond", rowsPerSecond) })
+	{
+		double expected;
+		if (!readNumber(baseline.str(), key, expected))
+		{
+			std::cerr << "Baseline has no " << key << std::endl;
+			result = 1;
+			continue;
+		}
+		double ratio = (expected > 0) ? (value / expected) : 1;
+		std::cout << key << ": " << value << " vs " << expected << ""
+			" (" << (0.1 * int(1000 * ratio)) << "%)" << std::endl;
+		if (ratio < 1 - tolerance)
+		{
+			std::cerr << "Regression in " << key << std::endl;
+			result = 1;
+		}
+	}
+	return result;
+}
+
+int main(int argc, char* argv[])
+{
+	return run(argc, argv);
+}
@@ -0,0 +1,274 @@
+#include "checkpointwriter.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+
+#include <sys/stat.h>
+
+#include <torch/torch.h>
+
+#include "genome.hpp"
+#include "objectstore.hpp"
+#include "populationfile.hpp"
+#include "trainingbrain.hpp"
+
+
+// The number of checkpoints that can wait while another is being written.
+constexpr size_t MAX_WAITING_CHECKPOINTS = 1;
+
+CheckpointWriter::CheckpointWriter()
+{
+	_thread = std::thread(&CheckpointWriter::work, this);
+}
+
+CheckpointWriter::~CheckpointWriter()
+{
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_stopping = true;
+	}
+	_added.notify_one();
+	_thread.join();
+}
+
+void CheckpointWriter::write(Checkpoint checkpoint)
+{
+	{
+		std::unique_lock<std::mutex> lock(_mutex);
+		_taken.wait(lock, [this]() {
+			return _checkpoints.size() < MAX_WAITING_CHECKPOINTS;
+		});
+		_checkpoints.push_back(std::move(checkpoint));
+	}
+	_added.notify_one();
+}
+
+void CheckpointWriter::flush()
+{
+	std::unique_lock<std::mutex> lock(_mutex);
+	_taken.wait(lock, [this]() {
+		return _checkpoints.empty() && !_writing;
+	});
+}
+
+void CheckpointWriter::work()
+{
+	std::unique_lock<std::mutex> lock(_mutex);
+	while (true)
+	{
+		_added.wait(lock, [this]() {
+			return _stopping || !_checkpoints.empty();
+		});
+		if (_checkpoints.empty())
+		{
+			return;
+		}
+		Checkpoint checkpoint = std::move(_checkpoints.front());
+		_checkpoints.pop_front();
+		_writing = true;
+		lock.unlock();
+		_taken.notify_all();
+
+		try
+		{
+			writeNow(checkpoint);
+		}
+		catch (const std::exception& e)
+		{
+			// Without the manifest the partial checkpoint is never used.
+			std::cerr << "Failed to write checkpoint"
+				" of round " << checkpoint.round << ": " << e.what() << ""
+				"" << std::endl;
+		}
+		// Free the snapshot before others can be added.
+		checkpoint.entries.clear();
+
+		lock.lock();
+		_writing = false;
+		_taken.notify_all();
+	}
+}
+
+// Replaces the file at the destination, if any, with the source file.
+static void renameReplacing(const std::string& source,
+	const std::string& destination)
+{
+	if (std::rename(source.c_str(), destination.c_str()) != 0)
+	{
+		// Renaming does not replace an existing file on Windows, but only
+		// remove it if there is something to replace it with.
+		struct stat buffer;
+		if (stat(source.c_str(), &buffer) != 0)
+		{
+			throw std::runtime_error("Failed to rename " + source);
+		}
+		std::remove(destination.c_str());
+		if (std::rename(source.c_str(), destination.c_str()) != 0)
+		{
+			throw std::runtime_error("Failed to rename " + source);
+		}
+	}
+}
+
+void CheckpointWriter::writeFile(const std::string& filepath,
+	const std::function<void(const std::string&)>& write,
+	std::vector<std::string>& written)
+{
+	if (_completedFiles.count(filepath))
+	{
+		std::cout << "Kept " << filepath << std::endl;
+		return;
+	}
+	// A file left by an earlier failure is never trusted.
+	std::string tmpFilepath = filepath + ".tmp";
+	std::remove(tmpFilepath.c_str());
+	try
+	{
+		write(tmpFilepath);
+		// Brains without a module write nothing.
+		struct stat buffer;
+		if (stat(tmpFilepath.c_str(), &buffer) != 0)
+		{
+			return;
+		}
+		renameReplacing(tmpFilepath, filepath);
+	}
+	catch (...)
+	{
+		std::remove(tmpFilepath.c_str());
+		throw;
+	}
+	written.push_back(filepath);
+}
+
+void CheckpointWriter::writeNow(Checkpoint& checkpoint)
+{
+	// This runs across rounds, so it records no spans, which must not be
+	// open while a trace of the training thread is written.
+	// Torch keeps the gradient mode per thread.
+	torch::NoGradGuard no_grad;
+	auto start = std::chrono::high_resolution_clock::now();
+
+	const std::string& folder = checkpoint.folder;
+	std::string filename = folder + "/round" + ""
+		"" + std::to_string(checkpoint.round) + ".txt";
+	std::vector<std::string> written;
+
+	std::stringstream list;
+	for (Checkpoint::Entry& entry : checkpoint.entries)
+	{
+		TrainingBrain& brain = *entry.brain;
+		const std::string& name = entry.name;
+
+		// Brains without a network only have a name and a score.
+		bool withGenome = false;
+		if (TrainingBrain::isNeural(brain.personality))
+		{
+			if (!entry.genomeCheckpoint.empty())
+			{
+				writeFile(entry.genomeCheckpoint,
+					[&](const std::string& path) { brain.save(path); },
+					written);
+			}
+			// If writing an earlier round failed, the checkpoint that the
+			// genome starts from may be missing, so then save the weights.
+			if (brain.genome)
+			{
+				withGenome = true;
+				for (const std::string& checkpoint
+					: genomeCheckpoints(*brain.genome))
+				{
+					struct stat buffer;
+					withGenome = withGenome
+						&& stat(checkpoint.c_str(), &buffer) == 0;
+				}
+			}
+
+			if (withGenome)
+			{
+				writeFile(folder + "/" + name + ".genome",
+					[&](const std::string& path) { brain.saveGenome(path); },
+					written);
+			}
+			else if (!entry.contentHash.empty())
+			{
+				ObjectStore(checkpoint.outputFolder).put(brain,
+					entry.contentHash);
+			}
+			else
+			{
+				writeFile(folder + "/" + name + ".pth.tar",
+					[&](const std::string& path) { brain.save(path); },
+					written);
+			}
+			if (entry.withCPUCopy)
+			{
+				writeFile(folder + "/" + name + "_cpu.pth.tar",
+					[&](const std::string& path) {
+						brain.save(path, /*forceCPU=*/true);
+					},
+					written);
+			}
+			writeFile(folder + "/" + name + ".png",
+				[&](const std::string& path) { brain.saveScan(path); },
+				written);
+			writeFile(folder + "/" + name + "_correlation.png",
+				[&](const std::string& path) {
+					brain.saveCorrelationScan(path);
+				},
+				written);
+		}
+
+		list << name << " "
+			<< (0.1 * int(10 * entry.objectiveScore));
+		if (!withGenome && !entry.contentHash.empty())
+		{
+			list << " " << entry.contentHash;
+		}
+		list << std::endl;
+	}
+
+	if (checkpoint.withPopulationFile)
+	{
+		std::string populationFilename = folder + "/round" + ""
+			"" + std::to_string(checkpoint.round) + ".population";
+		std::vector<const TrainingBrain*> brains;
+		for (const Checkpoint::Entry& entry : checkpoint.entries)
+		{
+			brains.push_back(entry.brain.get());
+		}
+		writeFile(populationFilename,
+			[&](const std::string& path) {
+				writePopulationFile(path, checkpoint.round, brains);
+			},
+			written);
+		std::cout << "Saved " << populationFilename << std::endl;
+	}
+
+	writeFile(filename,
+		[&](const std::string& path) {
+			std::ofstream file(path);
+			file << list.str();
+			file.close();
+			if (!file)
+			{
+				throw std::runtime_error("Failed to write " + path);
+			}
+		},
+		written);
+	_completedFiles.insert(written.begin(), written.end());
+
+	// Timing:
+	{
+		auto end = std::chrono::high_resolution_clock::now();
+		int elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+			end - start).count();
+		std::cout << "Writing round " << checkpoint.round << ""
+			" took " << elapsed << "ms"
+			"" << std::endl;
+	}
+}
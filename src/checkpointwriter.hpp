@@ -0,0 +1,79 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+class TrainingBrain;
+
+
+// The brains of one save round, copied so that they can be written while
+// the originals play on.
+struct Checkpoint
+{
+	std::string folder;
+	// The folder with the object store, if used.
+	std::string outputFolder;
+	size_t round = 0;
+	bool withPopulationFile = false;
+	struct Entry
+	{
+		std::unique_ptr<TrainingBrain> brain;
+		std::string name;
+		float objectiveScore = 0;
+		// Save the weights in the object store under this hash, if any.
+		std::string contentHash;
+		// Save the weights here first, if the genome starts from them.
+		std::string genomeCheckpoint;
+		// Also save a CPU copy, for the best brain of each personality.
+		bool withCPUCopy = false;
+	};
+	std::vector<Entry> entries;
+};
+
+// Writes checkpoints on a separate thread. Every file is written under a
+// temporary name that is renamed once it is complete, and the round's
+// manifest is written last, so it never refers to files that are only
+// partly written.
+class CheckpointWriter
+{
+private:
+	std::thread _thread;
+	std::mutex _mutex;
+	std::condition_variable _added;
+	std::condition_variable _taken;
+	std::deque<Checkpoint> _checkpoints;
+	bool _writing = false;
+	bool _stopping = false;
+	// The files of rounds whose manifest was written, which are kept
+	// instead of written again. Only used by the writing thread.
+	std::unordered_set<std::string> _completedFiles;
+
+public:
+	CheckpointWriter();
+	CheckpointWriter(const CheckpointWriter&) = delete;
+	CheckpointWriter(CheckpointWriter&& other) = delete;
+	CheckpointWriter& operator=(const CheckpointWriter&) = delete;
+	CheckpointWriter& operator=(CheckpointWriter&&) = delete;
+	// Writes what is left before returning.
+	~CheckpointWriter();
+
+	// Waits while another checkpoint is still waiting to be written,
+	// so that snapshots do not pile up when the disk is slow.
+	void write(Checkpoint checkpoint);
+	// Waits until everything has been written.
+	void flush();
+
+private:
+	void work();
+	void writeNow(Checkpoint& checkpoint);
+	void writeFile(const std::string& filepath,
+		const std::function<void(const std::string&)>& write,
+		std::vector<std::string>& written);
+};
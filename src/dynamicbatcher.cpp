@@ -0,0 +1,203 @@
+#include "dynamicbatcher.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+#include <thread>
+
+#include <torch/torch.h>
+
+#include "simulation.hpp"
+#include "trace.hpp"
+#include "trainingbrain.hpp"
+#include "workerpool.hpp"
+
+
+DynamicBatcher::DynamicBatcher(const Settings& settings, GameTable& games,
+		TrainingBrain* const* brains, size_t numTurnsPerGame) :
+	_settings(settings),
+	_games(games),
+	_brains(brains),
+	_numTurnsPerGame(numTurnsPerGame),
+	_queues(NUM_BRAIN_SLOTS),
+	_turnPerGame(games.size(), 0),
+	_nextGame(0),
+	_numFinished(0),
+	_aborted(false),
+	_numForwardCalls(0),
+	_numForwardRows(0)
+{}
+
+void DynamicBatcher::play(WorkerPool& workers,
+	std::vector<std::vector<TrainingTally>>& talliesPerThread)
+{
+	// A brain can have at most one row per game in flight in each batch.
+	size_t numInFlight = std::min(_games.size(),
+		std::max<size_t>(1, _settings.maxGamesInFlight));
+	for (size_t slot = 0; slot < NUM_BRAIN_SLOTS; slot++)
+	{
+		TrainingBrain* brain = _brains[slot];
+		size_t capacity = std::min<size_t>(brain->numGames, numInFlight);
+		for (size_t b = 0; b < 2; b++)
+		{
+			brain->numGamesPerSeat[b] = capacity;
+			brain->reset(b);
+			_queues[slot].games[b].reserve(capacity);
+		}
+		brain->numGamesPerSeat.fill(0);
+		_queues[slot].capacity = capacity;
+	}
+
+	_nextGame = numInFlight;
+	for (size_t g = 0; g < numInFlight; g++)
+	{
+		start(g);
+	}
+
+	// Every thread runs the same loop, starting at a different brain.
+	workers.run(workers.size(), [&](size_t, size_t, size_t thread) {
+		torch::NoGradGuard no_grad;
+		TrainingTally* tallies = talliesPerThread[thread].data();
+		size_t slot = thread * NUM_BRAIN_SLOTS / workers.size();
+		size_t numSkipped = 0;
+		try
+		{
+			while (_numFinished < _games.size() && !_aborted)
+			{
+				slot = (slot + 1) % NUM_BRAIN_SLOTS;
+				if (flush(slot, tallies))
+				{
+					numSkipped = 0;
+				}
+				else if (++numSkipped >= NUM_BRAIN_SLOTS)
+				{
+					// Nothing is ready, so give the other threads some room.
+					numSkipped = 0;
+					std::this_thread::yield();
+				}
+			}
+		}
+		catch (...)
+		{
+			_aborted = true;
+			throw;
+		}
+	});
+}
+
+void DynamicBatcher::start(size_t g)
+{
+	_turnPerGame[g] = 0;
+	post(g);
+}
+
+void DynamicBatcher::post(size_t g)
+{
+	size_t s = _turnPerGame[g] % NUM_SEATS;
+	size_t slot = _games.slotOfSeat[g][s];
+	Queue& queue = _queues[slot];
+	std::lock_guard<std::mutex> lock(queue.mutex);
+	size_t b = queue.collecting;
+	std::vector<uint32_t>& queued = queue.games[b];
+	if (queued.size() >= queue.capacity)
+	{
+		throw std::runtime_error("assertion failed");
+	}
+	if (queued.empty())
+	{
+		queue.oldest = Clock::now();
+	}
+	_games.batch[g][s] = b;
+	_games.relativeGameOffset[g][s] = queued.size();
+	queued.push_back(g);
+	_brains[slot]->numGamesPerSeat[b] = queued.size();
+	updateViewBuffers(_games, g, s, _brains);
+}
+
+void DynamicBatcher::finish(size_t /*g*/)
+{
+	size_t next = _nextGame++;
+	if (next < _games.size())
+	{
+		start(next);
+	}
+	_numFinished++;
+}
+
+bool DynamicBatcher::flush(size_t slot, TrainingTally* tallies)
+{
+	Queue& queue = _queues[slot];
+	size_t b;
+	{
+		std::unique_lock<std::mutex> lock(queue.mutex, std::try_to_lock);
+		if (!lock.owns_lock() || queue.busy)
+		{
+			return false;
+		}
+		b = queue.collecting;
+		size_t n = queue.games[b].size();
+		if (n == 0)
+		{
+			return false;
+		}
+		if (n < _settings.targetBatchSize
+			&& Clock::now() - queue.oldest < std::chrono::microseconds(
+				_settings.batchDeadlineMicroseconds))
+		{
+			return false;
+		}
+		// New games go into the other batch while this one is evaluated.
+		queue.busy = true;
+		queue.collecting = 1 - b;
+	}
+
+	TRACE_SCOPE("DynamicBatcher::flush", slot);
+	TrainingBrain* brain = _brains[slot];
+	brain->cycle(b);
+	// The games are in different turns, but the turn only matters
+	// for correlation, which is not tracked in these rounds.
+	brain->evaluate(b, 0, _settings);
+	if (TrainingBrain::isNeural(brain->personality))
+	{
+		_numForwardCalls += 1;
+		_numForwardRows += queue.games[b].size();
+	}
+	for (uint32_t g : queue.games[b])
+	{
+		takeTurn(g, tallies);
+	}
+
+	std::lock_guard<std::mutex> lock(queue.mutex);
+	queue.games[b].clear();
+	brain->numGamesPerSeat[b] = 0;
+	queue.busy = false;
+	return true;
+}
+
+void DynamicBatcher::takeTurn(size_t g, TrainingTally* tallies)
+{
+	size_t turn = _turnPerGame[g];
+	size_t s = turn % NUM_SEATS;
+	size_t t = turn / NUM_SEATS;
+	updateGameState(_games, g, s, _brains, tallies);
+	// Same as when playing in lockstep.
+	updateTurnsOfPass(_games, g, s, t);
+	if (_games.isFinished(g))
+	{
+		finish(g);
+		return;
+	}
+
+	// Players that have passed are skipped.
+	do
+	{
+		turn += 1;
+	}
+	while (turn < _numTurnsPerGame && _games.hasPassed(g, turn % NUM_SEATS));
+	if (turn >= _numTurnsPerGame)
+	{
+		finish(g);
+		return;
+	}
+	_turnPerGame[g] = turn;
+	post(g);
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <vector>
+
+#include "gametable.hpp"
+#include "settings.hpp"
+
+class TrainingBrain;
+class WorkerPool;
+struct TrainingTally;
+
+
+// Plays all games of a round without waiting for each other at every turn.
+// Each game waits in the queue of the brain whose turn it is. Every thread
+// evaluates whichever brain has enough games queued, or has kept one
+// waiting for too long, and then lets those games take their turn and
+// queue up for their next brain.
+class DynamicBatcher
+{
+private:
+	using Clock = std::chrono::steady_clock;
+
+	// Brains alternate between two of their batches, so that games can
+	// queue up in one while the other is being evaluated.
+	struct Queue
+	{
+		std::mutex mutex;
+		size_t collecting = 0;
+		std::array<std::vector<uint32_t>, 2> games;
+		Clock::time_point oldest;
+		bool busy = false;
+		size_t capacity = 0;
+	};
+
+	const Settings& _settings;
+	GameTable& _games;
+	TrainingBrain* const* _brains;
+	const size_t _numTurnsPerGame;
+	std::vector<Queue> _queues;
+	// The turn of each game, counting the turns of all seats.
+	std::vector<uint8_t> _turnPerGame;
+	std::atomic<size_t> _nextGame;
+	std::atomic<size_t> _numFinished;
+	// Set when a thread fails, so that the others stop waiting for games.
+	std::atomic<bool> _aborted;
+	std::atomic<size_t> _numForwardCalls;
+	std::atomic<size_t> _numForwardRows;
+
+public:
+	DynamicBatcher(const Settings& settings, GameTable& games,
+		TrainingBrain* const* brains, size_t numTurnsPerGame);
+	DynamicBatcher(const DynamicBatcher&) = delete;
+	DynamicBatcher& operator=(const DynamicBatcher&) = delete;
+
+	// Plays every game to the end, or until it runs out of turns.
+	void play(WorkerPool& workers,
+		std::vector<std::vector<TrainingTally>>& talliesPerThread);
+
+	size_t numForwardCalls() const { return _numForwardCalls; }
+	size_t numForwardRows() const { return _numForwardRows; }
+
+private:
+	void start(size_t g);
+	void post(size_t g);
+	void finish(size_t g);
+	// Evaluates the queued games of a brain if it is ready, and returns
+	// whether it did.
+	bool flush(size_t slot, TrainingTally* tallies);
+	void takeTurn(size_t g, TrainingTally* tallies);
+};
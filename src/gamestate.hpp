@@ -0,0 +1,77 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <array>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+#include "const.hpp"
+
+// Each set of cards is a bitboard where bit c is set if card c is in the set.
+static_assert(NUM_CARDS <= 64, "cards must fit in a 64-bit card set");
+
+constexpr uint64_t cardBit(size_t card)
+{
+	return uint64_t(1) << card;
+}
+
+constexpr uint64_t ALL_CARDS = (NUM_CARDS < 64)
+	? (cardBit(NUM_CARDS) - 1)
+	: ~uint64_t(0);
+
+inline size_t countCards(uint64_t cards)
+{
+#ifdef _MSC_VER
+	return __popcnt64(cards);
+#else
+	return __builtin_popcountll(cards);
+#endif
+}
+
+// Returns the lowest card in a non-empty set.
+inline size_t lowestCard(uint64_t cards)
+{
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanForward64(&index, cards);
+	return index;
+#else
+	return __builtin_ctzll(cards);
+#endif
+}
+
+// Removes the lowest card from a non-empty set and returns it.
+inline size_t popLowestCard(uint64_t& cards)
+{
+	size_t card = lowestCard(cards);
+	cards &= cards - 1;
+	return card;
+}
+
+// The cards whose suit (card % NUM_SUITS) is the given suit.
+constexpr uint64_t suitCards(size_t suit)
+{
+	uint64_t cards = 0;
+	for (size_t c = suit; c < NUM_CARDS; c += NUM_SUITS)
+	{
+		cards |= cardBit(c);
+	}
+	return cards;
+}
+
+struct GameState
+{
+	// Set 0 is the table, set 1 + s is the hand of seat s and
+	// set 1 + NUM_SEATS + s contains the cards seat s has seen
+	// in its own hand (so other players could have seen them too).
+	std::array<uint64_t, NUM_STATE_SETS> sets = { 0 };
+
+	uint64_t& table() { return sets[0]; }
+	uint64_t table() const { return sets[0]; }
+	uint64_t& hand(size_t s) { return sets[1 + s]; }
+	uint64_t hand(size_t s) const { return sets[1 + s]; }
+	uint64_t& vision(size_t s) { return sets[1 + NUM_SEATS + s]; }
+	uint64_t vision(size_t s) const { return sets[1 + NUM_SEATS + s]; }
+};
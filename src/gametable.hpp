@@ -0,0 +1,116 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <array>
+#include <vector>
+
+#include "const.hpp"
+#include "gamestate.hpp"
+
+// Every brain of every personality has a slot, numbered per personality.
+constexpr size_t NUM_BRAIN_SLOTS =
+	NUM_PERSONALITIES * NUM_BRAINS_PER_PERSONALITY;
+
+constexpr size_t brainSlot(size_t p, size_t i)
+{
+	return p * NUM_BRAINS_PER_PERSONALITY + i;
+}
+
+constexpr Personality personalityOfSlot(size_t slot)
+{
+	return Personality(slot / NUM_BRAINS_PER_PERSONALITY);
+}
+
+// When seats are staggered, each brain only plays in the steps whose number
+// modulo NUM_SEATS is its class, so that it evaluates all of its games
+// at once in those steps and not at all in the others.
+constexpr size_t staggerClassOfSlot(size_t slot)
+{
+	return (slot % NUM_BRAINS_PER_PERSONALITY) % NUM_SEATS;
+}
+
+static_assert(NUM_BRAIN_SLOTS <= UINT16_MAX, "brain slots must fit in 16 bits");
+static_assert(NUM_SEATS <= 8, "seat masks must fit in 8 bits");
+static_assert(NUM_BRAINS_PER_PERSONALITY >= NUM_SEATS,
+	"every stagger class needs a brain");
+
+// The games of a round, stored column by column so that the per-game loops
+// only touch the columns they need.
+struct GameTable
+{
+	// The brain slot of the player in each seat.
+	std::vector<std::array<uint16_t, NUM_SEATS>> slotOfSeat;
+	// The row of each player's game in its brain's batch for that seat.
+	std::vector<std::array<uint32_t, NUM_SEATS>> relativeGameOffset;
+	// Which of its brain's batches each player's row is in. Normally brains
+	// have one batch per seat, but staggered brains only need one and
+	// dynamically batched brains alternate between two.
+	std::vector<std::array<uint8_t, NUM_SEATS>> batch;
+	// The step in which seat 0 of each game takes its first turn.
+	// Always 0 unless seats are staggered.
+	std::vector<uint8_t> phase;
+	std::vector<std::array<int8_t, NUM_SEATS>> turnOfPass;
+	// Bit s is set if the player in seat s has passed or swapped.
+	std::vector<uint8_t> passedSeats;
+	std::vector<uint8_t> swappedSeats;
+	std::vector<GameState> state;
+
+	size_t size() const
+	{
+		return state.size();
+	}
+
+	void resize(size_t numGames)
+	{
+		slotOfSeat.resize(numGames);
+		relativeGameOffset.resize(numGames);
+		batch.resize(numGames);
+		phase.resize(numGames, 0);
+		turnOfPass.resize(numGames);
+		passedSeats.resize(numGames, 0);
+		swappedSeats.resize(numGames, 0);
+		state.resize(numGames);
+		for (auto& turns : turnOfPass)
+		{
+			turns.fill(-1);
+		}
+		for (auto& batches : batch)
+		{
+			for (size_t s = 0; s < NUM_SEATS; s++)
+			{
+				batches[s] = s;
+			}
+		}
+	}
+
+	Personality personality(size_t g, size_t s) const
+	{
+		return personalityOfSlot(slotOfSeat[g][s]);
+	}
+
+	size_t batchOf(size_t g, size_t s) const
+	{
+		return batch[g][s];
+	}
+
+	bool hasPassed(size_t g, size_t s) const
+	{
+		return (passedSeats[g] >> s) & 1;
+	}
+
+	bool hasSwapped(size_t g, size_t s) const
+	{
+		return (swappedSeats[g] >> s) & 1;
+	}
+
+	size_t numPassed(size_t g) const
+	{
+		return countCards(passedSeats[g]);
+	}
+
+	bool isFinished(size_t g) const
+	{
+		return passedSeats[g] == (1 << NUM_SEATS) - 1;
+	}
+};
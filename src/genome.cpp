@@ -0,0 +1,310 @@
+#include "genome.hpp"
+
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <sstream>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "module.hpp"
+#include "stateloader.hpp"
+
+
+std::shared_ptr<const Genome> makeCheckpointGenome(
+	const std::string& checkpoint)
+{
+	auto genome = std::make_shared<Genome>();
+	genome->operation = Genome::Operation::CHECKPOINT;
+	genome->checkpoint = checkpoint;
+	return genome;
+}
+
+std::shared_ptr<const Genome> makeMutationGenome(
+	std::shared_ptr<const Genome> parent, double deviationFactor,
+	uint64_t seed)
+{
+	auto genome = std::make_shared<Genome>();
+	genome->operation = Genome::Operation::MUTATION;
+	genome->seed = seed;
+	genome->deviationFactor = deviationFactor;
+	genome->parent = std::move(parent);
+	return genome;
+}
+
+std::shared_ptr<const Genome> makeSpliceGenome(
+	std::shared_ptr<const Genome> parent,
+	std::shared_ptr<const Genome> partner, uint64_t seed)
+{
+	auto genome = std::make_shared<Genome>();
+	genome->operation = Genome::Operation::SPLICE;
+	genome->seed = seed;
+	genome->parent = std::move(parent);
+	genome->partner = std::move(partner);
+	return genome;
+}
+
+size_t countGenomeSteps(const Genome& genome, size_t limit)
+{
+	std::unordered_set<const Genome*> visited;
+	std::vector<const Genome*> pending = { &genome };
+	while (!pending.empty() && visited.size() < limit)
+	{
+		const Genome* step = pending.back();
+		pending.pop_back();
+		if (!visited.insert(step).second)
+		{
+			continue;
+		}
+		if (step->parent)
+		{
+			pending.push_back(step->parent.get());
+		}
+		if (step->partner)
+		{
+			pending.push_back(step->partner.get());
+		}
+	}
+	return visited.size();
+}
+
+std::vector<std::string> genomeCheckpoints(const Genome& genome)
+{
+	std::vector<std::string> checkpoints;
+	std::unordered_set<const Genome*> visited;
+	std::vector<const Genome*> pending = { &genome };
+	while (!pending.empty())
+	{
+		const Genome* step = pending.back();
+		pending.pop_back();
+		if (!visited.insert(step).second)
+		{
+			continue;
+		}
+		if (step->operation == Genome::Operation::CHECKPOINT)
+		{
+			checkpoints.push_back(step->checkpoint);
+		}
+		if (step->parent)
+		{
+			pending.push_back(step->parent.get());
+		}
+		if (step->partner)
+		{
+			pending.push_back(step->partner.get());
+		}
+	}
+	return checkpoints;
+}
+
+// Counts how often each step is used by the steps made from it.
+static void countUses(const Genome& genome,
+	std::unordered_map<const Genome*, size_t>& numUses)
+{
+	for (const Genome* ancestor : { genome.parent.get(), genome.partner.get() })
+	{
+		if (ancestor && numUses[ancestor]++ == 0)
+		{
+			countUses(*ancestor, numUses);
+		}
+	}
+}
+
+// Replays each step once. The weights of a step that is used more than once
+// are kept until their last use.
+static void replayGenomeStep(const Genome& genome, Module& module,
+	std::unordered_map<const Genome*, size_t>& numUses,
+	std::unordered_map<const Genome*, Module>& kept)
+{
+	auto found = kept.find(&genome);
+	if (found != kept.end())
+	{
+		module.copyFrom(found->second);
+		if (--numUses[&genome] == 0)
+		{
+			kept.erase(found);
+		}
+		return;
+	}
+
+	switch (genome.operation)
+	{
+		case Genome::Operation::CHECKPOINT:
+		{
+			load_state_dict(module, genome.checkpoint);
+			module.to(torch::kCPU, torch::kFloat);
+		}
+		break;
+		case Genome::Operation::MUTATION:
+		{
+			replayGenomeStep(*genome.parent, module, numUses, kept);
+			module.mutate(genome.deviationFactor, genome.seed);
+		}
+		break;
+		case Genome::Operation::SPLICE:
+		{
+			replayGenomeStep(*genome.parent, module, numUses, kept);
+			Module partner;
+			partner.to(torch::kCPU, torch::kFloat);
+			replayGenomeStep(*genome.partner, partner, numUses, kept);
+			module.spliceWith(partner, genome.seed);
+		}
+		break;
+		default:
+		{
+			throw std::runtime_error("assertion failed");
+		}
+	}
+
+	if (numUses[&genome] > 1)
+	{
+		numUses[&genome] -= 1;
+		Module& copy = kept[&genome];
+		copy.to(torch::kCPU, torch::kFloat);
+		copy.copyFrom(module);
+	}
+}
+
+void replayGenome(const Genome& genome, Module& module)
+{
+	std::unordered_map<const Genome*, size_t> numUses;
+	numUses[&genome] = 1;
+	countUses(genome, numUses);
+	std::unordered_map<const Genome*, Module> kept;
+	replayGenomeStep(genome, module, numUses, kept);
+}
+
+static size_t writeGenomeStep(const Genome& genome, std::ostream& out,
+	std::unordered_map<const Genome*, size_t>& ids)
+{
+	auto found = ids.find(&genome);
+	if (found != ids.end())
+	{
+		return found->second;
+	}
+
+	size_t parentId = 0;
+	size_t partnerId = 0;
+	if (genome.parent)
+	{
+		parentId = writeGenomeStep(*genome.parent, out, ids);
+	}
+	if (genome.partner)
+	{
+		partnerId = writeGenomeStep(*genome.partner, out, ids);
+	}
+
+	size_t id = ids.size();
+	ids[&genome] = id;
+	switch (genome.operation)
+	{
+		case Genome::Operation::CHECKPOINT:
+		{
+			out << id << " checkpoint " << genome.checkpoint << "\n";
+		}
+		break;
+		case Genome::Operation::MUTATION:
+		{
+			out << id << " mutation " << parentId << " " << genome.seed << ""
+				" " << genome.deviationFactor << "\n";
+		}
+		break;
+		case Genome::Operation::SPLICE:
+		{
+			out << id << " splice " << parentId << " " << partnerId << ""
+				" " << genome.seed << "\n";
+		}
+		break;
+	}
+	return id;
+}
+
+void writeGenome(const Genome& genome, const std::string& filepath)
+{
+	std::ofstream file(filepath);
+	// Enough digits for the deviation factor to be read back exactly.
+	file << std::setprecision(std::numeric_limits<double>::max_digits10);
+	std::unordered_map<const Genome*, size_t> ids;
+	writeGenomeStep(genome, file, ids);
+	if (!file)
+	{
+		std::cerr << "Failed to write " << filepath << std::endl;
+		throw std::runtime_error("Failed to write " + filepath);
+	}
+}
+
+std::shared_ptr<const Genome> readGenome(const std::string& filepath)
+{
+	std::ifstream file(filepath);
+	if (!file)
+	{
+		std::cerr << "Failed to open " << filepath << std::endl;
+		throw std::runtime_error("Failed to open " + filepath);
+	}
+
+	std::vector<std::shared_ptr<const Genome>> steps;
+	auto stepWithId = [&](size_t id) {
+		if (id >= steps.size())
+		{
+			throw std::runtime_error("Invalid genome " + filepath);
+		}
+		return steps[id];
+	};
+	std::string line;
+	while (std::getline(file, line))
+	{
+		if (line.empty())
+		{
+			continue;
+		}
+		std::stringstream strm = std::stringstream(line);
+		size_t id;
+		std::string operation;
+		if (!(strm >> id >> operation) || id != steps.size())
+		{
+			throw std::runtime_error("Invalid genome " + filepath);
+		}
+		if (operation == "checkpoint")
+		{
+			std::string checkpoint;
+			strm >> std::ws;
+			std::getline(strm, checkpoint);
+			steps.push_back(makeCheckpointGenome(checkpoint));
+		}
+		else if (operation == "mutation")
+		{
+			size_t parentId;
+			uint64_t seed;
+			double deviationFactor;
+			if (!(strm >> parentId >> seed >> deviationFactor))
+			{
+				throw std::runtime_error("Invalid genome " + filepath);
+			}
+			steps.push_back(makeMutationGenome(stepWithId(parentId),
+				deviationFactor, seed));
+		}
+		else if (operation == "splice")
+		{
+			size_t parentId;
+			size_t partnerId;
+			uint64_t seed;
+			if (!(strm >> parentId >> partnerId >> seed))
+			{
+				throw std::runtime_error("Invalid genome " + filepath);
+			}
+			steps.push_back(makeSpliceGenome(stepWithId(parentId),
+				stepWithId(partnerId), seed));
+		}
+		else
+		{
+			throw std::runtime_error("Invalid genome " + filepath);
+		}
+	}
+	if (steps.empty())
+	{
+		throw std::runtime_error("Invalid genome " + filepath);
+	}
+	return steps.back();
+}
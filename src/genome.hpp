@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <string>
+#include <vector>
+
+class Module;
+
+
+// How the weights of a brain were made, starting from saved checkpoints.
+// Mutations and splices only depend on their seed on the CPU, so replaying
+// the steps gives the same weights. Genomes never change once made, so
+// brains share the genomes of their common ancestors.
+struct Genome
+{
+	enum class Operation : uint8_t
+	{
+		CHECKPOINT,
+		MUTATION,
+		SPLICE,
+	};
+
+	Operation operation = Operation::CHECKPOINT;
+	// The file with the weights, for a checkpoint.
+	std::string checkpoint;
+	uint64_t seed = 0;
+	double deviationFactor = 0;
+	// The brain this one was made from, and the other parent of a splice.
+	std::shared_ptr<const Genome> parent;
+	std::shared_ptr<const Genome> partner;
+};
+
+std::shared_ptr<const Genome> makeCheckpointGenome(
+	const std::string& checkpoint);
+std::shared_ptr<const Genome> makeMutationGenome(
+	std::shared_ptr<const Genome> parent, double deviationFactor,
+	uint64_t seed);
+std::shared_ptr<const Genome> makeSpliceGenome(
+	std::shared_ptr<const Genome> parent,
+	std::shared_ptr<const Genome> partner, uint64_t seed);
+
+// The number of checkpoints, mutations and splices that replaying the
+// genome takes, counting shared ancestors once. Stops counting at the limit.
+size_t countGenomeSteps(const Genome& genome,
+	size_t limit = std::numeric_limits<size_t>::max());
+
+// The files of the checkpoints that the genome starts from.
+std::vector<std::string> genomeCheckpoints(const Genome& genome);
+
+// Rebuilds the weights of the genome in the module, which must be a float
+// module on the CPU. Shared ancestors are only replayed once.
+void replayGenome(const Genome& genome, Module& module);
+
+// A genome file has one line per step, each ancestor only once and before
+// the steps that use it, and ends with the brain itself:
+//     <id> checkpoint <filepath>
+//     <id> mutation <parent id> <seed> <deviation factor>
+//     <id> splice <parent id> <partner id> <seed>
+void writeGenome(const Genome& genome, const std::string& filepath);
+std::shared_ptr<const Genome> readGenome(const std::string& filepath);
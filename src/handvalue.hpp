@@ -0,0 +1,162 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <array>
+
+#include "const.hpp"
+#include "gamestate.hpp"
+
+// Some personalities score their hands differently.
+enum class HandRule
+{
+	NORMAL,
+	// Up to one non-Ace clubs becomes a spade, or up to one non-Ace diamond
+	// becomes a heart, as long as the Illusionist has not swapped.
+	ILLUSIONIST,
+	// The Fool is trained to only receive points for sets.
+	FOOL,
+};
+constexpr size_t NUM_HAND_RULES = size_t(HandRule::FOOL) + 1;
+
+// Every hand of three different cards.
+constexpr size_t NUM_HANDS =
+	NUM_CARDS * (NUM_CARDS - 1) * (NUM_CARDS - 2) / 6;
+
+static_assert(NUM_CARDS_PER_HAND == 3, "hands are indexed as triples");
+
+// The position of the hand {a, b, c} with a < b < c among all hands,
+// according to the combinatorial number system.
+constexpr size_t handIndex(size_t a, size_t b, size_t c)
+{
+	return a + b * (b - 1) / 2 + c * (c - 1) * (c - 2) / 6;
+}
+
+constexpr float computeHandValue(HandRule rule, size_t a, size_t b, size_t c)
+{
+	constexpr int VALUE_PER_FACE[NUM_FACES_PER_SUIT] = {
+		7, 8, 9, 10, 10, 10, 10, 11
+	};
+	constexpr size_t NO_FACE = 255;
+
+	const size_t hand[NUM_CARDS_PER_HAND] = { a, b, c };
+	bool hasMatch = true;
+	size_t matchingFace = 0;
+	float suitValue[NUM_SUITS] = { 0 };
+	for (size_t h = 0; h < NUM_CARDS_PER_HAND; h++)
+	{
+		size_t suit = hand[h] % NUM_SUITS;
+		size_t face = hand[h] / NUM_SUITS;
+		if (face < NUM_FACES_PER_SUIT)
+		{
+			suitValue[suit] += VALUE_PER_FACE[face];
+		}
+		else
+		{
+			switch (hand[h] - NUM_SUITS * NUM_FACES_PER_SUIT)
+			{
+				case 0:
+				case 3:
+				{
+					// suit = suit;
+					face = NUM_FACES_PER_SUIT - 1; // ace
+					suitValue[suit] += 11;
+				}
+				break;
+				case 1:
+				{
+					face = NO_FACE;
+					// joker has no value
+				}
+				break;
+				case 2:
+				{
+					// suit = suit;
+					face = NUM_FACES_PER_SUIT;
+					suitValue[suit] += 12;
+				}
+				break;
+			}
+		}
+		if (h > 0)
+		{
+			hasMatch = hasMatch && (face == matchingFace);
+		}
+		else
+		{
+			matchingFace = face;
+		}
+	}
+
+	if (rule == HandRule::ILLUSIONIST)
+	{
+		if (suitValue[0] <= 10 && suitValue[3] >= 14)
+		{
+			suitValue[3] += suitValue[0];
+		}
+		else if (suitValue[1] <= 10 && suitValue[2] >= 14)
+		{
+			suitValue[2] += suitValue[1];
+		}
+	}
+
+	float v = 0;
+	for (size_t suit = 0; suit < NUM_SUITS; suit++)
+	{
+		if (v < suitValue[suit])
+		{
+			v = suitValue[suit];
+		}
+	}
+
+	if (hasMatch && matchingFace == NUM_FACES_PER_SUIT - 1)
+	{
+		return 31.0f;
+	}
+	else if (hasMatch && v < 30.5f)
+	{
+		return 30.5f;
+	}
+	else if (rule == HandRule::FOOL)
+	{
+		return 0;
+	}
+	else
+	{
+		return v;
+	}
+}
+
+constexpr std::array<std::array<float, NUM_HANDS>, NUM_HAND_RULES>
+	makeHandValueTable()
+{
+	std::array<std::array<float, NUM_HANDS>, NUM_HAND_RULES> table = {};
+	for (size_t r = 0; r < NUM_HAND_RULES; r++)
+	{
+		for (size_t c = 2; c < NUM_CARDS; c++)
+		{
+			for (size_t b = 1; b < c; b++)
+			{
+				for (size_t a = 0; a < b; a++)
+				{
+					table[r][handIndex(a, b, c)] =
+						computeHandValue(HandRule(r), a, b, c);
+				}
+			}
+		}
+	}
+	return table;
+}
+
+// Generated at compile time, so the rules only exist in this header.
+inline constexpr std::array<std::array<float, NUM_HANDS>, NUM_HAND_RULES>
+	HAND_VALUE_TABLE = makeHandValueTable();
+
+// The value of a set of exactly three cards.
+inline float handValue(HandRule rule, uint64_t cards)
+{
+	size_t a = popLowestCard(cards);
+	size_t b = popLowestCard(cards);
+	size_t c = lowestCard(cards);
+	return HAND_VALUE_TABLE[size_t(rule)][handIndex(a, b, c)];
+}
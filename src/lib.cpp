@@ -26,26 +26,28 @@ extern "C" void module_evaluate(Module* module, const float* input,
 {
 	std::vector<size_t> tableCards;
 	std::vector<size_t> ownCards;
+	uint64_t tableMask = 0;
+	uint64_t ownMask = 0;
 	for (size_t i = 0; i < NUM_CARDS; i++)
 	{
 		if (input[i] > 0)
 		{
 			tableCards.push_back(i);
+			tableMask |= uint64_t(1) << i;
 		}
 		else if (input[NUM_CARDS + i] > 0)
 		{
 			ownCards.push_back(i);
+			ownMask |= uint64_t(1) << i;
 		}
 	}
 
-	torch::Tensor inputTensor = torch::from_blob(
-		(void*) input,
-		int(NUM_VIEW_SETS * NUM_CARDS),
-		torch::kFloat);
-	torch::Tensor outputTensor = module->forward(inputTensor)
-		.to(torch::kCPU, torch::kFloat);
+	// Only the outputs of the legal actions are computed, and only those
+	// are read below.
+	float output[ACTION_SIZE] = { 0 };
+	module->forwardLegal(input, NUM_VIEW_SETS * NUM_CARDS, 1,
+		&tableMask, &ownMask, output, ACTION_SIZE, /*quantized=*/false);
 
-	const float* output = outputTensor.data_ptr<float>();
 	float passWeight = output[2 * NUM_CARDS];
 	float swapWeight = output[2 * NUM_CARDS + 1];
 	float tableCardWeight = passWeight - 1;
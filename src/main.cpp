@@ -6,6 +6,7 @@
 #include <sys/stat.h>
 #endif
 
+#include "objectstore.hpp"
 #include "trainer.hpp"
 
 static uint64_t currentMilliseconds()
@@ -16,6 +17,12 @@ static uint64_t currentMilliseconds()
 
 void run(int argc, char* argv[])
 {
+	Settings settings = Settings::parse(argc, argv);
+	if (settings.collectGarbage)
+	{
+		ObjectStore::collectGarbage(settings.outputFolder);
+		return;
+	}
 	std::string session;
 	int round = 0;
 
@@ -35,11 +42,21 @@ void run(int argc, char* argv[])
 
 	srand(currentMilliseconds());
 
-	Trainer trainer;
+	Trainer trainer(settings);
 	if (!session.empty())
 	{
 		trainer.resume(session, round);
 	}
+	if (settings.convertOnly)
+	{
+		if (session.empty())
+		{
+			std::cerr << "No session to convert" << std::endl;
+			return;
+		}
+		trainer.writePopulation(session, round);
+		return;
+	}
 	trainer.train();
 
 	std::cout << std::endl << "Done!" << std::endl;
@@ -0,0 +1,135 @@
+#include "metrics.hpp"
+
+#include <iostream>
+#include <sstream>
+
+#ifdef _MSC_VER
+#define NOMINMAX
+#include <windows.h>
+#include <psapi.h>
+#pragma comment(lib, "psapi.lib")
+#else
+#include <sys/resource.h>
+#endif
+
+
+size_t peakMemoryBytes()
+{
+#ifdef _MSC_VER
+	PROCESS_MEMORY_COUNTERS counters;
+	if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+	{
+		return 0;
+	}
+	return counters.PeakWorkingSetSize;
+#else
+	struct rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) != 0)
+	{
+		return 0;
+	}
+	// Linux reports kilobytes.
+	return size_t(usage.ru_maxrss) * 1024;
+#endif
+}
+
+std::string toJson(const RoundMetrics& metrics)
+{
+	std::stringstream strm;
+	strm << "{\"round\": " << metrics.round << ""
+		", \"saved\": " << (metrics.saved ? "true" : "false") << ""
+		", \"numGames\": " << metrics.numGames << ""
+		", \"numUnfinishedPerTurn\": [";
+	for (size_t t = 0; t < metrics.numUnfinishedPerTurn.size(); t++)
+	{
+		strm << ((t > 0) ? ", " : "") << metrics.numUnfinishedPerTurn[t];
+	}
+	strm << "]"
+		", \"numForwardCalls\": " << metrics.numForwardCalls << ""
+		", \"numForwardRows\": " << metrics.numForwardRows << ""
+		", \"peakMemoryBytes\": " << metrics.peakMemoryBytes << ""
+		", \"totalMs\": " << metrics.totalMs << ""
+		", \"dealMs\": " << metrics.dealMs << ""
+		", \"viewMs\": " << metrics.viewMs << ""
+		", \"evaluateMs\": " << metrics.evaluateMs << ""
+		", \"updateMs\": " << metrics.updateMs << ""
+		", \"tallyMs\": " << metrics.tallyMs << ""
+		", \"sortMs\": " << metrics.sortMs << ""
+		", \"evolveMs\": " << metrics.evolveMs << ""
+		", \"saveMs\": " << metrics.saveMs << ""
+		", \"personalities\": [";
+	for (size_t p = 0; p < metrics.personalities.size(); p++)
+	{
+		const PersonalityMetrics& personality = metrics.personalities[p];
+		strm << ((p > 0) ? ", " : "") << ""
+			"{\"name\": \"" << personality.name << "\""
+			", \"numGames\": " << personality.numGames << ""
+			", \"score\": " << personality.averageScore << ""
+			", \"survival\": " << personality.survivalRate << ""
+			", \"turns\": " << personality.averageTurnsBeforePass << ""
+			", \"handValue\": " << personality.averageHandValue << ""
+			", \"winValue\": " << personality.averageWinValue << ""
+			", \"lossValue\": " << personality.averageLossValue << ""
+			", \"bias\": " << personality.totalSquaredSuitBias << ""
+			", \"suitBias\": [" << personality.suitBias[0] << ""
+			", " << personality.suitBias[1] << ""
+			", " << personality.suitBias[2] << ""
+			", " << personality.suitBias[3] << "]"
+			", \"confidence\": " << personality.averageConfidence << "}";
+	}
+	strm << "]}";
+	return strm.str();
+}
+
+MetricsSink::MetricsSink(const std::string& filepath) :
+	_file(filepath, std::ofstream::app)
+{
+	if (!_file)
+	{
+		std::cerr << "Failed to open " << filepath << std::endl;
+	}
+	_thread = std::thread(&MetricsSink::work, this);
+}
+
+MetricsSink::~MetricsSink()
+{
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_stopping = true;
+	}
+	_added.notify_one();
+	_thread.join();
+}
+
+void MetricsSink::write(const RoundMetrics& metrics)
+{
+	std::string line = toJson(metrics);
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_lines.push_back(std::move(line));
+	}
+	_added.notify_one();
+}
+
+void MetricsSink::work()
+{
+	std::unique_lock<std::mutex> lock(_mutex);
+	while (true)
+	{
+		_added.wait(lock, [this]() { return _stopping || !_lines.empty(); });
+		if (_lines.empty())
+		{
+			return;
+		}
+		std::deque<std::string> lines;
+		lines.swap(_lines);
+		lock.unlock();
+		for (const std::string& line : lines)
+		{
+			_file << line << "\n";
+		}
+		// Flush every round, so that the file can be followed while training.
+		_file.flush();
+		lock.lock();
+	}
+}
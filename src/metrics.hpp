@@ -0,0 +1,87 @@
+#pragma once
+
+#include <array>
+#include <condition_variable>
+#include <deque>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "const.hpp"
+
+
+// How the brains of one personality did in a round.
+struct PersonalityMetrics
+{
+	std::string name;
+	int numGames = 0;
+	float averageScore = 0;
+	float survivalRate = 0;
+	float averageTurnsBeforePass = 0;
+	float averageHandValue = 0;
+	float averageWinValue = 0;
+	float averageLossValue = 0;
+	float totalSquaredSuitBias = 0;
+	std::array<float, NUM_SUITS> suitBias = { 0 };
+	float averageConfidence = 0;
+};
+
+// Where the time of a round went, in milliseconds, and how it went.
+struct RoundMetrics
+{
+	size_t round = 0;
+	// Whether the correlation was calculated and the brains were saved.
+	bool saved = false;
+	size_t numGames = 0;
+	// The number of games still being played after each turn.
+	std::vector<size_t> numUnfinishedPerTurn;
+	// The number of times a network was run, and the rows that went through.
+	size_t numForwardCalls = 0;
+	size_t numForwardRows = 0;
+	size_t peakMemoryBytes = 0;
+	double totalMs = 0;
+	double dealMs = 0;
+	double viewMs = 0;
+	double evaluateMs = 0;
+	double updateMs = 0;
+	double tallyMs = 0;
+	double sortMs = 0;
+	double evolveMs = 0;
+	double saveMs = 0;
+	std::vector<PersonalityMetrics> personalities;
+};
+
+// The most memory this process has used so far.
+size_t peakMemoryBytes();
+
+// The metrics as a single line of JSON.
+std::string toJson(const RoundMetrics& metrics);
+
+// Appends one line of JSON per round to a file. The lines are written
+// by a separate thread, so the training loop never waits for the disk.
+class MetricsSink
+{
+private:
+	std::ofstream _file;
+	std::thread _thread;
+	std::mutex _mutex;
+	std::condition_variable _added;
+	std::deque<std::string> _lines;
+	bool _stopping = false;
+
+public:
+	explicit MetricsSink(const std::string& filepath);
+	MetricsSink(const MetricsSink&) = delete;
+	MetricsSink(MetricsSink&& other) = delete;
+	MetricsSink& operator=(const MetricsSink&) = delete;
+	MetricsSink& operator=(MetricsSink&&) = delete;
+	// Writes what is left before returning.
+	~MetricsSink();
+
+	void write(const RoundMetrics& metrics);
+
+private:
+	void work();
+};
@@ -0,0 +1,277 @@
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <torch/torch.h>
+
+#include "const.hpp"
+#include "gametable.hpp"
+#include "module.hpp"
+#include "settings.hpp"
+#include "simulation.hpp"
+#include "trainingbrain.hpp"
+
+// Measures the hot paths of the trainer one by one on synthetic data.
+// Each measurement is repeated, and reported as the mean time per operation
+// with its standard deviation and the resulting throughput.
+
+
+struct Options
+{
+	size_t numRepetitions = 20;
+	std::string filter;
+	std::string folder = ".";
+};
+
+static volatile float sink = 0;
+
+template<typename Setup, typename Body>
+void measure(const Options& options, const std::string& name,
+	const char* unit, size_t numOps, Setup setup, Body body)
+{
+	if (!options.filter.empty() && name.find(options.filter) == std::string::npos)
+	{
+		return;
+	}
+
+	// Warm up caches and lazily built state first.
+	setup();
+	body();
+
+	std::vector<double> samples;
+	for (size_t r = 0; r < options.numRepetitions; r++)
+	{
+		setup();
+		auto start = std::chrono::high_resolution_clock::now();
+		body();
+		auto end = std::chrono::high_resolution_clock::now();
+		double ns = std::chrono::duration<double, std::nano>(end - start).count();
+		samples.push_back(ns / numOps);
+	}
+
+	double mean = 0;
+	for (double sample : samples) mean += sample;
+	mean /= samples.size();
+	double variance = 0;
+	for (double sample : samples) variance += (sample - mean) * (sample - mean);
+	variance /= std::max<size_t>(1, samples.size() - 1);
+	double stddev = std::sqrt(variance);
+
+	std::cout << std::left << std::setw(40) << name
+		<< std::right << std::setw(14) << std::fixed << std::setprecision(1)
+		<< mean << " ns/" << std::left << std::setw(6) << unit
+		<< std::right << " +- " << std::setw(10) << stddev
+		<< " (" << std::setw(5) << (100 * stddev / mean) << "%)"
+		<< std::setw(16) << std::setprecision(0) << (1e9 / mean)
+		<< " " << unit << "/s" << std::endl;
+}
+
+// Deals random games where seat 0 is played by the given brain.
+static GameTable dealGames(size_t numGames, Personality personality,
+	std::mt19937& rng)
+{
+	GameTable games;
+	games.resize(numGames);
+	std::array<uint8_t, NUM_SUITS * NUM_FACES_PER_SUIT> deck;
+	for (size_t c = 0; c < deck.size(); c++)
+	{
+		deck[c] = c;
+	}
+	for (size_t g = 0; g < numGames; g++)
+	{
+		std::shuffle(deck.begin(), deck.end(), rng);
+		size_t deckoffset = 0;
+		for (size_t hand = 0; hand < NUM_SEATS + 1; hand++)
+		{
+			for (size_t z = 0; z < NUM_CARDS_PER_HAND; z++)
+			{
+				games.state[g].sets[hand] |= cardBit(deck[deckoffset++]);
+			}
+		}
+		games.slotOfSeat[g][0] = brainSlot(size_t(personality), 0);
+		games.relativeGameOffset[g][0] = g;
+		for (size_t s = 1; s < NUM_SEATS; s++)
+		{
+			games.slotOfSeat[g][s] = brainSlot(size_t(Personality::DUMMY), 0);
+			games.relativeGameOffset[g][s] = g;
+		}
+	}
+	return games;
+}
+
+static void benchmarkSimulation(const Options& options, std::mt19937& rng)
+{
+	const size_t numGames = 1024;
+	TrainingBrain dummy(Personality::DUMMY);
+	TrainingBrain neural(Personality::NORMAL1);
+	TrainingBrain greedy(Personality::GREEDY);
+	for (TrainingBrain* brain : { &dummy, &neural, &greedy })
+	{
+		for (size_t s = 0; s < NUM_SEATS; s++)
+		{
+			brain->numGamesPerSeat[s] = numGames;
+			brain->reset(s);
+		}
+	}
+	std::vector<TrainingBrain*> brains(NUM_BRAIN_SLOTS, &dummy);
+	brains[brainSlot(size_t(Personality::NORMAL1), 0)] = &neural;
+	brains[brainSlot(size_t(Personality::GREEDY), 0)] = &greedy;
+	std::vector<TrainingTally> tallies(NUM_BRAIN_SLOTS);
+
+	{
+		GameTable games = dealGames(numGames, Personality::FOOL, rng);
+		std::vector<uint64_t> hands(numGames);
+		for (uint64_t& hand : hands)
+		{
+			while (countCards(hand) < NUM_CARDS_PER_HAND)
+			{
+				hand |= cardBit(rng() % NUM_CARDS);
+			}
+		}
+		measure(options, "determineHandValue", "hand", numGames,
+			[]() {},
+			[&]() {
+				float total = 0;
+				for (size_t g = 0; g < numGames; g++)
+				{
+					total += determineHandValue(games, g, g % NUM_SEATS,
+						hands[g]);
+				}
+				sink = total;
+			});
+	}
+
+	{
+		GameTable games = dealGames(numGames, Personality::NORMAL1, rng);
+		measure(options, "updateViewBuffers", "view", numGames,
+			[]() {},
+			[&]() {
+				for (size_t g = 0; g < numGames; g++)
+				{
+					updateViewBuffers(games, g, 0, brains.data());
+				}
+			});
+	}
+
+	for (TrainingBrain* brain : { &neural, &greedy })
+	{
+		Personality personality = brain->personality;
+		GameTable dealt = dealGames(numGames, personality, rng);
+		for (size_t g = 0; g < numGames; g++)
+		{
+			updateViewBuffers(dealt, g, 0, brains.data());
+		}
+		brain->cycle(0);
+		brain->evaluate(0, 0, Settings());
+		GameTable games;
+		measure(options, std::string("updateGameState (")
+				+ TrainingBrain::personalityName(personality) + ")",
+			"game", numGames,
+			[&]() { games = dealt; },
+			[&]() {
+				for (size_t g = 0; g < numGames; g++)
+				{
+					updateGameState(games, g, 0, brains.data(), tallies.data());
+				}
+			});
+	}
+}
+
+static void benchmarkModule(const Options& options)
+{
+	Module module;
+	module.to(torch::kFloat);
+	for (size_t batchSize : { 1, 64, 256, 1024 })
+	{
+		torch::Tensor input = torch::randint(0, 2,
+			{int(batchSize), int(NUM_VIEW_SETS * NUM_CARDS)}, torch::kFloat);
+		torch::Tensor output = torch::zeros(
+			{int(batchSize), int(ACTION_SIZE)}, torch::kFloat);
+		std::string suffix = " (batch " + std::to_string(batchSize) + ")";
+
+		measure(options, "Module::forward" + suffix, "row", batchSize,
+			[]() {},
+			[&]() { sink = module.forward(input)[0][0].item<float>(); });
+
+		for (const auto& [kernelName, kernel] : {
+				std::make_pair("fused", InferenceKernel::FUSED),
+				std::make_pair("int8", InferenceKernel::QUANTIZED) })
+		{
+			Settings settings;
+			settings.inferenceKernel = kernel;
+			measure(options,
+				std::string("Module::forward ") + kernelName + suffix,
+				"row", batchSize,
+				[]() {},
+				[&]() { module.forward(input, output, settings); });
+		}
+	}
+
+	Module other;
+	other.to(torch::kFloat);
+	uint64_t seed = 0;
+	measure(options, "Module::mutate", "call", 1,
+		[]() {},
+		[&]() { module.mutate(0.01, seed++); });
+	measure(options, "Module::spliceWith", "call", 1,
+		[]() {},
+		[&]() { module.spliceWith(other, seed++); });
+}
+
+static void benchmarkFiles(const Options& options)
+{
+	TrainingBrain brain(Personality::NORMAL1);
+	std::string filepath = options.folder + "/microbench.pth.tar";
+	std::string scanpath = options.folder + "/microbench.png";
+
+	// Start from a missing file, as a new checkpoint does.
+	measure(options, "save_state_dict", "file", 1,
+		[&]() { std::remove(filepath.c_str()); },
+		[&]() { brain.save(filepath); });
+	measure(options, "load_state_dict", "file", 1,
+		[]() {},
+		[&]() { brain.load(filepath); });
+	measure(options, "writeScan", "file", 1,
+		[&]() { std::remove(scanpath.c_str()); },
+		[&]() { brain.saveScan(scanpath); });
+
+	std::remove(filepath.c_str());
+	std::remove(scanpath.c_str());
+}
+
+int main(int argc, char* argv[])
+{
+	Options options;
+	for (int i = 1; i < argc; i++)
+	{
+		std::string arg = argv[i];
+		if (arg == "--repetitions" && i + 1 < argc)
+		{
+			options.numRepetitions = std::max<size_t>(2, strtoul(argv[++i], nullptr, 10));
+		}
+		else if (arg == "--filter" && i + 1 < argc)
+		{
+			options.filter = argv[++i];
+		}
+		else if (arg == "--folder" && i + 1 < argc)
+		{
+			options.folder = argv[++i];
+		}
+		else
+		{
+			std::cerr << "Ignoring unknown option " << arg << std::endl;
+		}
+	}
+
+	std::mt19937 rng(1);
+	torch::manual_seed(1);
+	benchmarkSimulation(options, rng);
+	benchmarkModule(options);
+	benchmarkFiles(options);
+	return 0;
+}
@@ -0,0 +1,321 @@
+#include "mlpkernel.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <type_traits>
+
+#if defined(__AVX512F__) || defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+
+// Each block of the kernel keeps BLOCK_ROWS x 2 vectors of accumulators
+// in registers, and each tile of rows is run through all layers while
+// its activations still fit in the L2 cache.
+constexpr size_t BLOCK_ROWS = 4;
+constexpr size_t TILE_ROWS = 64;
+
+#if defined(__AVX512F__)
+using Vec = __m512;
+constexpr size_t VECTOR_SIZE = 16;
+inline Vec vload(const float* p) { return _mm512_loadu_ps(p); }
+inline Vec vload(const int8_t* p)
+{
+	__m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+	return _mm512_cvtepi32_ps(_mm512_cvtepi8_epi32(bytes));
+}
+inline void vstore(float* p, Vec v) { _mm512_storeu_ps(p, v); }
+inline Vec vbroadcast(float x) { return _mm512_set1_ps(x); }
+inline Vec vfma(Vec a, Vec b, Vec c) { return _mm512_fmadd_ps(a, b, c); }
+inline Vec vrelu(Vec v) { return _mm512_max_ps(v, _mm512_setzero_ps()); }
+inline float vsum(Vec v) { return _mm512_reduce_add_ps(v); }
+#elif defined(__AVX2__)
+using Vec = __m256;
+constexpr size_t VECTOR_SIZE = 8;
+inline Vec vload(const float* p) { return _mm256_loadu_ps(p); }
+inline Vec vload(const int8_t* p)
+{
+	__m128i bytes = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(p));
+	return _mm256_cvtepi32_ps(_mm256_cvtepi8_epi32(bytes));
+}
+inline void vstore(float* p, Vec v) { _mm256_storeu_ps(p, v); }
+inline Vec vbroadcast(float x) { return _mm256_set1_ps(x); }
+#ifdef __FMA__
+inline Vec vfma(Vec a, Vec b, Vec c) { return _mm256_fmadd_ps(a, b, c); }
+#else
+inline Vec vfma(Vec a, Vec b, Vec c)
+{
+	return _mm256_add_ps(_mm256_mul_ps(a, b), c);
+}
+#endif
+inline Vec vrelu(Vec v) { return _mm256_max_ps(v, _mm256_setzero_ps()); }
+inline float vsum(Vec v)
+{
+	__m128 x = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+	x = _mm_add_ps(x, _mm_movehl_ps(x, x));
+	x = _mm_add_ss(x, _mm_movehdup_ps(x));
+	return _mm_cvtss_f32(x);
+}
+#else
+using Vec = float;
+constexpr size_t VECTOR_SIZE = 1;
+inline Vec vload(const float* p) { return *p; }
+inline Vec vload(const int8_t* p) { return float(*p); }
+inline void vstore(float* p, Vec v) { *p = v; }
+inline Vec vbroadcast(float x) { return x; }
+inline Vec vfma(Vec a, Vec b, Vec c) { return a * b + c; }
+inline Vec vrelu(Vec v) { return std::max(v, 0.0f); }
+inline float vsum(Vec v) { return v; }
+#endif
+
+constexpr size_t BLOCK_COLUMNS = 2 * VECTOR_SIZE;
+static_assert(MLP_PADDING % BLOCK_COLUMNS == 0,
+	"padding must be a multiple of the block width");
+
+void PackedLayer::pack(const float* weight, const float* bias,
+	size_t numOutputs, size_t numInputs, size_t paddedInputs)
+{
+	this->numInputs = paddedInputs;
+	this->numOutputs = numOutputs;
+	this->stride = paddedSize(numOutputs);
+	this->weights.assign(paddedInputs * stride, 0.0f);
+	this->bias.assign(stride, 0.0f);
+	this->quantizedWeights.clear();
+	this->scales.clear();
+	this->rowWeights.clear();
+	for (size_t o = 0; o < numOutputs; o++)
+	{
+		for (size_t i = 0; i < numInputs; i++)
+		{
+			this->weights[i * stride + o] = weight[o * numInputs + i];
+		}
+		this->bias[o] = bias[o];
+	}
+}
+
+void PackedLayer::quantize()
+{
+	quantizedWeights.resize(weights.size());
+	scales.assign(stride, 0.0f);
+	for (size_t o = 0; o < stride; o++)
+	{
+		float maxAbs = 0;
+		for (size_t i = 0; i < numInputs; i++)
+		{
+			maxAbs = std::max(maxAbs, std::abs(weights[i * stride + o]));
+		}
+		float scale = (maxAbs > 0) ? (maxAbs / 127) : 1.0f;
+		scales[o] = scale;
+		for (size_t i = 0; i < numInputs; i++)
+		{
+			float q = std::round(weights[i * stride + o] / scale);
+			quantizedWeights[i * stride + o] = int8_t(
+				std::max(-127.0f, std::min(q, 127.0f)));
+		}
+	}
+}
+
+void PackedLayer::packRows()
+{
+	rowWeights.assign(numOutputs * numInputs, 0.0f);
+	for (size_t o = 0; o < numOutputs; o++)
+	{
+		for (size_t i = 0; i < numInputs; i++)
+		{
+			rowWeights[o * numInputs + i] = weights[i * stride + o];
+		}
+	}
+}
+
+inline const float* weightsOf(const PackedLayer& layer, const float*)
+{
+	return layer.weights.data();
+}
+
+inline const int8_t* weightsOf(const PackedLayer& layer, const int8_t*)
+{
+	return layer.quantizedWeights.data();
+}
+
+template<size_t ROWS, typename W>
+inline void multiplyBlock(const PackedLayer& layer,
+	const float* in, size_t inStride, float* out, size_t outStride,
+	size_t column, bool skipZeros, bool relu)
+{
+	// Quantized weights are scaled per output, so their bias is added
+	// after scaling the sum.
+	constexpr bool quantized = std::is_same<W, int8_t>::value;
+	Vec acc[ROWS][2];
+	for (size_t r = 0; r < ROWS; r++)
+	{
+		if (quantized)
+		{
+			acc[r][0] = vbroadcast(0);
+			acc[r][1] = vbroadcast(0);
+		}
+		else
+		{
+			acc[r][0] = vload(&layer.bias[column]);
+			acc[r][1] = vload(&layer.bias[column + VECTOR_SIZE]);
+		}
+	}
+	const W* weights = weightsOf(layer, (const W*) nullptr) + column;
+	for (size_t k = 0; k < layer.numInputs; k++)
+	{
+		if (skipZeros)
+		{
+			bool allZero = true;
+			for (size_t r = 0; r < ROWS; r++)
+			{
+				allZero &= (in[r * inStride + k] == 0);
+			}
+			if (allZero) continue;
+		}
+		Vec w0 = vload(&weights[k * layer.stride]);
+		Vec w1 = vload(&weights[k * layer.stride + VECTOR_SIZE]);
+		for (size_t r = 0; r < ROWS; r++)
+		{
+			Vec x = vbroadcast(in[r * inStride + k]);
+			acc[r][0] = vfma(x, w0, acc[r][0]);
+			acc[r][1] = vfma(x, w1, acc[r][1]);
+		}
+	}
+	if (quantized)
+	{
+		Vec s0 = vload(&layer.scales[column]);
+		Vec s1 = vload(&layer.scales[column + VECTOR_SIZE]);
+		Vec b0 = vload(&layer.bias[column]);
+		Vec b1 = vload(&layer.bias[column + VECTOR_SIZE]);
+		for (size_t r = 0; r < ROWS; r++)
+		{
+			acc[r][0] = vfma(acc[r][0], s0, b0);
+			acc[r][1] = vfma(acc[r][1], s1, b1);
+		}
+	}
+	for (size_t r = 0; r < ROWS; r++)
+	{
+		if (relu)
+		{
+			acc[r][0] = vrelu(acc[r][0]);
+			acc[r][1] = vrelu(acc[r][1]);
+		}
+		vstore(&out[r * outStride + column], acc[r][0]);
+		vstore(&out[r * outStride + column + VECTOR_SIZE], acc[r][1]);
+	}
+}
+
+template<typename W>
+inline void multiplyTile(const PackedLayer& layer,
+	const float* in, size_t inStride, size_t numRows,
+	float* out, size_t outStride, bool skipZeros, bool relu)
+{
+	// Go through the columns in the outer loop, so that the weights of
+	// a column block stay in cache while all rows of the tile use them.
+	for (size_t column = 0; column < layer.stride; column += BLOCK_COLUMNS)
+	{
+		size_t r = 0;
+		for (; r + BLOCK_ROWS <= numRows; r += BLOCK_ROWS)
+		{
+			multiplyBlock<BLOCK_ROWS, W>(layer,
+				&in[r * inStride], inStride, &out[r * outStride], outStride,
+				column, skipZeros, relu);
+		}
+		for (; r < numRows; r++)
+		{
+			multiplyBlock<1, W>(layer,
+				&in[r * inStride], inStride, &out[r * outStride], outStride,
+				column, skipZeros, relu);
+		}
+	}
+}
+
+// Computes only the selected outputs of each row, each as a single dot
+// product, which is cheaper than the whole layer when few are selected.
+inline void multiplySelected(const PackedLayer& layer,
+	const float* in, size_t inStride, size_t numRows,
+	float* out, size_t outStride, const uint32_t* offsets,
+	const uint16_t* indices)
+{
+	for (size_t r = 0; r < numRows; r++)
+	{
+		const float* row = &in[r * inStride];
+		for (uint32_t k = offsets[r]; k < offsets[r + 1]; k++)
+		{
+			size_t o = indices[k];
+			const float* weights = &layer.rowWeights[o * layer.numInputs];
+			Vec acc = vbroadcast(0);
+			for (size_t i = 0; i < layer.numInputs; i += VECTOR_SIZE)
+			{
+				acc = vfma(vload(&row[i]), vload(&weights[i]), acc);
+			}
+			float x = vsum(acc) + layer.bias[o];
+			out[r * outStride + o] = 1.0f / (1.0f + std::exp(-x));
+		}
+	}
+}
+
+void PackedMlp::run(const float* input, size_t inputStride, size_t numRows,
+	float* output, size_t outputStride, bool quantized,
+	const OutputSelection* selection) const
+{
+	if (layers.empty())
+	{
+		return;
+	}
+	size_t maxStride = 0;
+	for (const PackedLayer& layer : layers)
+	{
+		maxStride = std::max(maxStride, layer.stride);
+	}
+	// Each thread keeps its own activations, so that brains can be
+	// evaluated in parallel without allocating.
+	thread_local std::vector<float> front;
+	thread_local std::vector<float> back;
+	front.resize(TILE_ROWS * maxStride);
+	back.resize(TILE_ROWS * maxStride);
+
+	const PackedLayer& last = layers.back();
+	size_t numFullLayers = layers.size() - (selection ? 1 : 0);
+	for (size_t begin = 0; begin < numRows; begin += TILE_ROWS)
+	{
+		size_t n = std::min(TILE_ROWS, numRows - begin);
+		const float* in = &input[begin * inputStride];
+		size_t inStride = inputStride;
+		for (size_t l = 0; l < numFullLayers; l++)
+		{
+			const PackedLayer& layer = layers[l];
+			bool isLast = (l + 1 == layers.size());
+			if (quantized)
+			{
+				multiplyTile<int8_t>(layer, in, inStride, n,
+					front.data(), layer.stride,
+					/*skipZeros=*/(l == 0), /*relu=*/!isLast);
+			}
+			else
+			{
+				multiplyTile<float>(layer, in, inStride, n,
+					front.data(), layer.stride,
+					/*skipZeros=*/(l == 0), /*relu=*/!isLast);
+			}
+			std::swap(front, back);
+			in = back.data();
+			inStride = layer.stride;
+		}
+		if (selection)
+		{
+			multiplySelected(last, in, inStride, n,
+				&output[begin * outputStride], outputStride,
+				&selection->offsets[begin], selection->indices);
+			continue;
+		}
+		for (size_t r = 0; r < n; r++)
+		{
+			const float* row = &in[r * last.stride];
+			float* result = &output[(begin + r) * outputStride];
+			for (size_t o = 0; o < last.numOutputs; o++)
+			{
+				result[o] = 1.0f / (1.0f + std::exp(-row[o]));
+			}
+		}
+	}
+}
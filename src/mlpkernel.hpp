@@ -0,0 +1,78 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+
+// The packed outputs of each layer are padded to a multiple of this,
+// so that the kernel never needs a partial vector.
+constexpr size_t MLP_PADDING = 32;
+
+constexpr size_t paddedSize(size_t n)
+{
+	return (n + MLP_PADDING - 1) / MLP_PADDING * MLP_PADDING;
+}
+
+// A fully connected layer with its weights transposed to [input][output],
+// so that the weights of each input are contiguous.
+struct PackedLayer
+{
+	std::vector<float> weights;
+	std::vector<float> bias;
+	size_t numInputs = 0;
+	size_t numOutputs = 0;
+	// The number of outputs rounded up to MLP_PADDING, padded with zeros.
+	size_t stride = 0;
+	// The same weights as int8, with one scale per output. Only filled in
+	// by quantize(), and cleared when the layer is packed again.
+	std::vector<int8_t> quantizedWeights;
+	std::vector<float> scales;
+	// What the layer was packed from, to see if it needs to be packed again.
+	const void* source = nullptr;
+	int64_t version = -1;
+	// The weights in the original [output][input] order, for computing
+	// single outputs. Only filled in by packRows().
+	std::vector<float> rowWeights;
+
+	// Packs a torch-style [output][input] weight matrix. The inputs of a
+	// layer that follows another packed layer have to be padded as well.
+	void pack(const float* weight, const float* bias,
+		size_t numOutputs, size_t numInputs, size_t paddedInputs);
+	void quantize();
+	void packRows();
+};
+
+// Which outputs to compute for each row, as compressed rows: the outputs
+// of row r are indices[offsets[r]] up to indices[offsets[r + 1]].
+struct OutputSelection
+{
+	const uint32_t* offsets = nullptr;
+	const uint16_t* indices = nullptr;
+};
+
+// The packed layers of a network, with ReLU between the layers
+// and a sigmoid at the end.
+struct PackedMlp
+{
+	std::vector<PackedLayer> layers;
+
+	PackedMlp() = default;
+	// Copies start out unpacked, because a copy of a module
+	// is usually about to get different weights.
+	PackedMlp(const PackedMlp&) {}
+	PackedMlp& operator=(const PackedMlp&) { layers.clear(); return *this; }
+
+	// Runs numRows rows of input through all layers and writes numOutputs
+	// floats per row. Inputs that are zero for a whole block of rows are
+	// skipped in the first layer, which helps a lot for the binary views.
+	// If quantized is true, the layers must have been quantized and
+	// the int8 weights are used instead, which is a quarter of the memory
+	// traffic at a small cost in precision.
+	// With a selection, only the selected outputs of the last layer are
+	// computed and written, always with the float rows packed by packRows(),
+	// and the other outputs are left as they are.
+	void run(const float* input, size_t inputStride, size_t numRows,
+		float* output, size_t outputStride, bool quantized = false,
+		const OutputSelection* selection = nullptr) const;
+};
@@ -1,12 +1,21 @@
 #include "module.hpp"
 
 #include "const.hpp"
+#include "gamestate.hpp"
+#include "mutationkernel.hpp"
 
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <iterator>
 #include <random>
 
 
 #define INNER_SIZE 500
 
+// Added to the parameter index to get the Philox streams of spliceWith().
+constexpr uint32_t SPLICE_STREAM = 0x10000;
+
 Module::Module() :
 	_fc1(register_module("fc1", torch::nn::Linear(
 		NUM_VIEW_SETS * NUM_CARDS,
@@ -28,12 +37,32 @@ Module::Module() :
 	eval();
 }
 
+Module::Module(UninitializedTag) :
+	_fc1(register_module("fc1", torch::nn::Linear(1, 1))),
+	_fc2(register_module("fc2", torch::nn::Linear(1, 1))),
+	_fc3(register_module("fc3", torch::nn::Linear(1, 1))),
+	_fc4(register_module("fc4", torch::nn::Linear(1, 1))),
+	_fc5(register_module("fc5", torch::nn::Linear(1, 1)))
+{
+	eval();
+}
+
+void Module::matchOptionsToWeights()
+{
+	for (torch::nn::Linear* layer : { &_fc1, &_fc2, &_fc3, &_fc4, &_fc5 })
+	{
+		(*layer)->options.in_features((*layer)->weight.size(1));
+		(*layer)->options.out_features((*layer)->weight.size(0));
+	}
+}
+
 Module::Module(Module&& other) :
 	_fc1(register_module("fc1", std::move(other._fc1))),
 	_fc2(register_module("fc2", std::move(other._fc2))),
 	_fc3(register_module("fc3", std::move(other._fc3))),
 	_fc4(register_module("fc4", std::move(other._fc4))),
-	_fc5(register_module("fc5", std::move(other._fc5)))
+	_fc5(register_module("fc5", std::move(other._fc5))),
+	_row(std::move(other._row))
 {}
 
 Module& Module::operator=(Module&& other)
@@ -45,6 +74,7 @@ Module& Module::operator=(Module&& other)
 		_fc3 = register_module("fc3", std::move(other._fc3));
 		_fc4 = register_module("fc4", std::move(other._fc4));
 		_fc5 = register_module("fc5", std::move(other._fc5));
+		_row = std::move(other._row);
 	}
 	return *this;
 }
@@ -60,12 +90,237 @@ torch::Tensor Module::forward(const torch::Tensor& input) const
 	return s;
 }
 
-void Module::mutate(double deviationFactor)
+void Module::forward(const torch::Tensor& input, torch::Tensor& output,
+	const Settings& settings) const
+{
+	switch (settings.inferenceKernel)
+	{
+		case InferenceKernel::TORCH:
+		break;
+		case InferenceKernel::FUSED:
+		case InferenceKernel::QUANTIZED:
+		{
+			bool quantized =
+				(settings.inferenceKernel == InferenceKernel::QUANTIZED);
+			forwardFused(input.data_ptr<float>(), input.size(1), input.size(0),
+				output.data_ptr<float>(), output.size(1), quantized);
+			return;
+		}
+		break;
+		case InferenceKernel::VERIFY:
+		{
+			forwardFused(input.data_ptr<float>(), input.size(1), input.size(0),
+				output.data_ptr<float>(), output.size(1), false);
+			torch::Tensor expected = forward(input);
+			float difference = (output - expected).abs().max().item<float>();
+			if (!(difference <= 1e-3f))
+			{
+				std::cerr << "fused kernel differs from torch"
+					" by " << difference << std::endl;
+				throw std::runtime_error("assertion failed");
+			}
+			return;
+		}
+		break;
+	}
+
+	// Write the last layer straight into the output, which must be contiguous.
+	torch::Tensor s;
+	s = torch::relu(firstLayer(input, settings.firstLayerMode));
+	s = torch::relu(torch::linear(s, _fc2->weight, _fc2->bias));
+	s = torch::relu(torch::linear(s, _fc3->weight, _fc3->bias));
+	s = torch::relu(torch::linear(s, _fc4->weight, _fc4->bias));
+	torch::addmm_out(output, _fc5->bias, s, _fc5->weight.t());
+	output.sigmoid_();
+}
+
+torch::Tensor Module::firstLayer(const torch::Tensor& input,
+	FirstLayerMode firstLayerMode) const
+{
+	switch (firstLayerMode)
+	{
+		case FirstLayerMode::DENSE:
+		{
+			return torch::linear(input, _fc1->weight, _fc1->bias);
+		}
+		break;
+		case FirstLayerMode::SPARSE:
+		{
+			return sparseFirstLayer(input);
+		}
+		break;
+		case FirstLayerMode::VERIFY:
+		{
+			torch::Tensor dense = torch::linear(input, _fc1->weight, _fc1->bias);
+			torch::Tensor sparse = sparseFirstLayer(input);
+			float difference = (sparse - dense).abs().max().item<float>();
+			if (!(difference <= 1e-3f))
+			{
+				std::cerr << "sparse first layer differs from dense"
+					" by " << difference << std::endl;
+				throw std::runtime_error("assertion failed");
+			}
+			return sparse;
+		}
+		break;
+	}
+	throw std::runtime_error("assertion failed");
+}
+
+torch::Tensor Module::sparseFirstLayer(const torch::Tensor& input) const
+{
+	const torch::Tensor& weight = _fc1->weight;
+	if (!_fc1Transposed.defined()
+		|| _fc1TransposedSource != weight.data_ptr()
+		|| _fc1TransposedVersion != weight._version())
+	{
+		_fc1Transposed = weight.t().contiguous();
+		_fc1TransposedSource = weight.data_ptr();
+		_fc1TransposedVersion = weight._version();
+	}
+
+	const size_t numRows = input.size(0);
+	const size_t numInputs = input.size(1);
+	torch::Tensor inputCPU = input.contiguous();
+	torch::Tensor result = torch::empty({int(numRows), INNER_SIZE},
+		torch::kFloat);
+	const float* in = inputCPU.data_ptr<float>();
+	const float* columns = _fc1Transposed.data_ptr<float>();
+	const float* bias = _fc1->bias.data_ptr<float>();
+	float* out = result.data_ptr<float>();
+	for (size_t r = 0; r < numRows; r++)
+	{
+		const float* view = &in[r * numInputs];
+		float* row = &out[r * INNER_SIZE];
+		std::copy(bias, bias + INNER_SIZE, row);
+		for (size_t i = 0; i < numInputs; i++)
+		{
+			// Almost all inputs are 0 or 1.
+			float x = view[i];
+			if (x == 0)
+			{
+				continue;
+			}
+			const float* column = &columns[i * INNER_SIZE];
+			if (x == 1)
+			{
+				for (size_t j = 0; j < INNER_SIZE; j++)
+				{
+					row[j] += column[j];
+				}
+			}
+			else
+			{
+				for (size_t j = 0; j < INNER_SIZE; j++)
+				{
+					row[j] += x * column[j];
+				}
+			}
+		}
+	}
+	return result;
+}
+
+void Module::forwardFused(const float* input, size_t inputStride,
+	size_t numRows, float* output, size_t outputStride, bool quantized,
+	const OutputSelection* selection) const
+{
+	// Without rows there is nothing to pack the weights for.
+	if (numRows == 0)
+	{
+		return;
+	}
+
+	const torch::nn::Linear layers[] = { _fc1, _fc2, _fc3, _fc4, _fc5 };
+	_packed.layers.resize(std::size(layers));
+	for (size_t l = 0; l < std::size(layers); l++)
+	{
+		const torch::Tensor& weight = layers[l]->weight;
+		PackedLayer& packed = _packed.layers[l];
+		if (packed.source == weight.data_ptr()
+			&& packed.version == weight._version())
+		{
+			continue;
+		}
+		size_t numOutputs = weight.size(0);
+		size_t numInputs = weight.size(1);
+		packed.pack(weight.data_ptr<float>(),
+			layers[l]->bias.data_ptr<float>(),
+			numOutputs, numInputs,
+			(l == 0) ? numInputs : paddedSize(numInputs));
+		packed.source = weight.data_ptr();
+		packed.version = weight._version();
+	}
+	if (quantized)
+	{
+		for (PackedLayer& packed : _packed.layers)
+		{
+			if (packed.quantizedWeights.empty())
+			{
+				packed.quantize();
+			}
+		}
+	}
+	if (selection && _packed.layers.back().rowWeights.empty())
+	{
+		_packed.layers.back().packRows();
+	}
+
+	_packed.run(input, inputStride, numRows, output, outputStride, quantized,
+		selection);
+}
+
+void Module::forwardLegal(const float* input, size_t inputStride,
+	size_t numRows, const uint64_t* tableCards, const uint64_t* handCards,
+	float* output, size_t outputStride, bool quantized) const
+{
+	if (numRows == 0)
+	{
+		return;
+	}
+
+	thread_local std::vector<uint32_t> offsets;
+	thread_local std::vector<uint16_t> indices;
+	offsets.resize(numRows + 1);
+	indices.clear();
+	for (size_t r = 0; r < numRows; r++)
+	{
+		offsets[r] = indices.size();
+		for (uint64_t cards = tableCards[r]; cards != 0; )
+		{
+			indices.push_back(popLowestCard(cards));
+		}
+		for (uint64_t cards = handCards[r]; cards != 0; )
+		{
+			indices.push_back(NUM_CARDS + popLowestCard(cards));
+		}
+		indices.push_back(2 * NUM_CARDS);
+		indices.push_back(2 * NUM_CARDS + 1);
+	}
+	offsets[numRows] = indices.size();
+
+	OutputSelection selection;
+	selection.offsets = offsets.data();
+	selection.indices = indices.data();
+	forwardFused(input, inputStride, numRows, output, outputStride, quantized,
+		&selection);
+}
+
+void Module::mutate(double deviationFactor, uint64_t seed)
 {
+	forgetPackedWeights();
+
 	std::vector<torch::Tensor>& myParams = parameters();
 	for (size_t i = 0; i < myParams.size(); i++)
 	{
 		torch::Tensor& param = myParams[i];
+		if (param.device().is_cpu() && param.scalar_type() == torch::kFloat
+			&& param.is_contiguous())
+		{
+			addMaskedNoise(param.data_ptr<float>(), param.numel(),
+				float(deviationFactor), seed, uint32_t(i));
+			continue;
+		}
 		// Take the standard normal deviation.
 		torch::Tensor mutationTensor = torch::randn(param.sizes(),
 			torch::TensorOptions().device(param.device()).dtype(param.dtype()));
@@ -80,13 +335,27 @@ void Module::mutate(double deviationFactor)
 	}
 }
 
-void Module::spliceWith(const Module& other)
+void Module::spliceWith(const Module& other, uint64_t seed)
 {
+	forgetPackedWeights();
+
 	std::vector<torch::Tensor>& myParams = parameters();
 	const std::vector<torch::Tensor>& otherParams = other.parameters();
 	for (size_t i = 0; i < myParams.size() && i < otherParams.size(); i++)
 	{
 		torch::Tensor& param = myParams[i];
+		const torch::Tensor& otherParam = otherParams[i];
+		if (param.device().is_cpu() && param.scalar_type() == torch::kFloat
+			&& param.is_contiguous() && otherParam.is_contiguous()
+			&& otherParam.scalar_type() == torch::kFloat)
+		{
+			// Use other streams than mutate(), because a brain can be
+			// mutated and spliced with the same seed.
+			takeMaskedValues(param.data_ptr<float>(),
+				otherParam.data_ptr<float>(), param.numel(),
+				seed, SPLICE_STREAM + uint32_t(i));
+			continue;
+		}
 		// Select half the weights of this parameter.
 		torch::Tensor selectionTensor = torch::randint(0, 2, param.sizes(),
 			torch::TensorOptions().device(param.device()).dtype(torch::kBool));
@@ -96,8 +365,38 @@ void Module::spliceWith(const Module& other)
 		selectionTensor.logical_not_();
 		// Take those weights from the other module.
 		selectionTensor = selectionTensor.to(param.dtype());
-		selectionTensor.mul_(otherParams[i]);
+		selectionTensor.mul_(otherParam);
 		// Add the mutations.
 		param.add_(selectionTensor);
 	}
 }
+
+void Module::copyFrom(const Module& other)
+{
+	if (&other == this)
+	{
+		return;
+	}
+	if (_row.defined() && other._row.defined()
+		&& _row.numel() == other._row.numel())
+	{
+		forgetPackedWeights();
+		std::memcpy(_row.data_ptr<float>(), other._row.data_ptr<float>(),
+			_row.nbytes());
+		return;
+	}
+
+	torch::NoGradGuard no_grad;
+	std::vector<torch::Tensor> myParams = parameters();
+	const std::vector<torch::Tensor>& otherParams = other.parameters();
+	for (size_t i = 0; i < myParams.size() && i < otherParams.size(); i++)
+	{
+		myParams[i].copy_(otherParams[i]);
+	}
+}
+
+void Module::forgetPackedWeights()
+{
+	_packed.layers.clear();
+	_fc1TransposedSource = nullptr;
+}
@@ -2,12 +2,16 @@
 
 #include <torch/torch.h>
 
+#include "mlpkernel.hpp"
+#include "settings.hpp"
+
 
 class Module : public torch::nn::Cloneable<Module>
 {
 private:
 	friend class Brain;
 	friend class TrainingBrain;
+	friend class ParameterArena;
 
 	torch::nn::Linear _fc1;
 	torch::nn::Linear _fc2;
@@ -15,6 +19,16 @@ private:
 	torch::nn::Linear _fc4;
 	torch::nn::Linear _fc5;
 
+	// The first layer's weights transposed, so that the weights of each input
+	// are contiguous. Rebuilt when the weights are replaced or changed.
+	mutable torch::Tensor _fc1Transposed;
+	mutable const void* _fc1TransposedSource = nullptr;
+	mutable int64_t _fc1TransposedVersion = 0;
+	// All layers packed for the fused kernel, packed again when changed.
+	mutable PackedMlp _packed;
+	// The row of a ParameterArena that the parameters are views of, if any.
+	torch::Tensor _row;
+
 public:
 	Module();
 	Module(const Module&) = default;
@@ -29,7 +43,43 @@ public:
 	}
 
 	torch::Tensor forward(const torch::Tensor& input) const;
+	void forward(const torch::Tensor& input, torch::Tensor& output,
+		const Settings& settings) const;
+
+	// Runs rows of floats on the CPU through the fused kernel,
+	// using the int8 snapshot of the weights if quantized is true.
+	void forwardFused(const float* input, size_t inputStride, size_t numRows,
+		float* output, size_t outputStride, bool quantized,
+		const OutputSelection* selection = nullptr) const;
+	// The same, but only computes the outputs for the legal actions of each
+	// row: the cards on the table, the cards in hand, pass and swap.
+	// The other outputs of each row are left as they are.
+	void forwardLegal(const float* input, size_t inputStride, size_t numRows,
+		const uint64_t* tableCards, const uint64_t* handCards,
+		float* output, size_t outputStride, bool quantized) const;
+
+	// Adds noise to half of the weights. On the CPU the noise only depends
+	// on the seed, and nothing is allocated.
+	void mutate(double deviationFactor, uint64_t seed);
+	// Takes half of the weights from the other module. On the CPU the choice
+	// only depends on the seed.
+	void spliceWith(const Module& other, uint64_t seed);
+	// Overwrites the parameters with those of the other module, keeping them
+	// where they are. Within an arena this is a single copy of the row.
+	void copyFrom(const Module& other);
+
+private:
+	// Layers of a single weight, for a ParameterArena that replaces the
+	// parameters right away, so that the real ones are never initialized.
+	struct UninitializedTag {};
+	explicit Module(UninitializedTag);
+	// Makes the sizes of the layers match their replaced parameters.
+	void matchOptionsToWeights();
+
+	// Needed after changing the weights in place, which torch does not notice.
+	void forgetPackedWeights();
 
-	void mutate(double deviationFactor);
-	void spliceWith(const Module& other);
+	torch::Tensor firstLayer(const torch::Tensor& input,
+		FirstLayerMode firstLayerMode) const;
+	torch::Tensor sparseFirstLayer(const torch::Tensor& input) const;
 };
@@ -0,0 +1,90 @@
+#include "mutationkernel.hpp"
+
+#include <algorithm>
+#include <math.h>
+
+#include "philox.hpp"
+
+
+// Each block of values is generated from NUM_COUNTERS consecutive counters,
+// with word w of counter j going to value w * NUM_COUNTERS + j. Keeping the
+// words of each kind together lets the compiler vectorize every loop below.
+constexpr size_t NUM_COUNTERS = 16;
+constexpr size_t BLOCK_SIZE = 4 * NUM_COUNTERS;
+
+void addMaskedNoise(float* values, size_t size, float deviation,
+	uint64_t key, uint32_t stream)
+{
+	constexpr float TWO_PI = 6.28318530717958647692f;
+	alignas(64) uint32_t bits[BLOCK_SIZE];
+	alignas(64) float noise[BLOCK_SIZE];
+	for (size_t begin = 0; begin < size; begin += BLOCK_SIZE)
+	{
+		uint32_t firstCounter = uint32_t(begin / 4);
+		for (size_t j = 0; j < NUM_COUNTERS; j++)
+		{
+			PhiloxCounter words = philox(
+				{ uint32_t(firstCounter + j), stream, 0, 0 }, key);
+			for (size_t w = 0; w < 4; w++)
+			{
+				bits[w * NUM_COUNTERS + j] = words[w];
+			}
+		}
+
+		// The top 24 bits of each word become a uniform number in (0, 1),
+		// and pairs of those become two normal numbers (Box-Muller).
+		// This uses the C functions, which have vector versions in glibc.
+		for (size_t half = 0; half < 2; half++)
+		{
+			const uint32_t* a = &bits[half * 2 * NUM_COUNTERS];
+			const uint32_t* b = a + NUM_COUNTERS;
+			float* x = &noise[half * 2 * NUM_COUNTERS];
+			float* y = x + NUM_COUNTERS;
+			for (size_t j = 0; j < NUM_COUNTERS; j++)
+			{
+				float u = (float(a[j] >> 8) + 0.5f) * (1.0f / 16777216);
+				float v = (float(b[j] >> 8) + 0.5f) * (1.0f / 16777216);
+				float radius = deviation * sqrtf(-2 * logf(u));
+				x[j] = radius * cosf(TWO_PI * v);
+				// Not sinf, because the compiler would merge that with cosf
+				// into a sincosf that it cannot vectorize.
+				y[j] = radius * cosf(TWO_PI * v - TWO_PI / 4);
+			}
+		}
+
+		// The lowest bit of each word decides whether the value changes.
+		size_t n = std::min(BLOCK_SIZE, size - begin);
+		float* block = &values[begin];
+		for (size_t i = 0; i < n; i++)
+		{
+			block[i] += (bits[i] & 1) ? noise[i] : 0.0f;
+		}
+	}
+}
+
+void takeMaskedValues(float* values, const float* others, size_t size,
+	uint64_t key, uint32_t stream)
+{
+	alignas(64) uint32_t bits[BLOCK_SIZE];
+	for (size_t begin = 0; begin < size; begin += BLOCK_SIZE)
+	{
+		uint32_t firstCounter = uint32_t(begin / 4);
+		for (size_t j = 0; j < NUM_COUNTERS; j++)
+		{
+			PhiloxCounter words = philox(
+				{ uint32_t(firstCounter + j), stream, 0, 0 }, key);
+			for (size_t w = 0; w < 4; w++)
+			{
+				bits[w * NUM_COUNTERS + j] = words[w];
+			}
+		}
+
+		size_t n = std::min(BLOCK_SIZE, size - begin);
+		float* block = &values[begin];
+		const float* otherBlock = &others[begin];
+		for (size_t i = 0; i < n; i++)
+		{
+			block[i] = (bits[i] & 1) ? otherBlock[i] : block[i];
+		}
+	}
+}
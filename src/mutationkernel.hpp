@@ -0,0 +1,17 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+
+// Adds Gaussian noise with the given deviation to a random half of the
+// values, in place and without allocating. The noise only depends on the
+// key, the stream and the index of each value, so the same mutation can
+// be made again from those alone.
+void addMaskedNoise(float* values, size_t size, float deviation,
+	uint64_t key, uint32_t stream);
+
+// Replaces a random half of the values with the other values, chosen the
+// same way as the values that addMaskedNoise changes.
+void takeMaskedValues(float* values, const float* others, size_t size,
+	uint64_t key, uint32_t stream);
@@ -0,0 +1,240 @@
+#include "objectstore.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <unordered_set>
+
+#include <sys/stat.h>
+
+#include "trainingbrain.hpp"
+
+
+inline uint64_t rotateLeft(uint64_t x, int r)
+{
+	return (x << r) | (x >> (64 - r));
+}
+
+// The finalizer of MurmurHash3.
+inline uint64_t mix(uint64_t x)
+{
+	x ^= x >> 33;
+	x *= 0xFF51AFD7ED558CCDull;
+	x ^= x >> 33;
+	x *= 0xC4CEB9FE1A85EC53ull;
+	x ^= x >> 33;
+	return x;
+}
+
+// Hashes blocks of 32 bytes as four independent lanes, so that the
+// multiplications of different lanes overlap.
+class Hasher
+{
+private:
+	uint64_t _lanes[4] = {
+		0x9E3779B97F4A7C15ull, 0xBF58476D1CE4E5B9ull,
+		0x94D049BB133111EBull, 0x2545F4914F6CDD1Dull };
+	uint8_t _pending[32];
+	size_t _numPending = 0;
+	uint64_t _length = 0;
+
+	void block(const uint8_t* bytes)
+	{
+		for (size_t l = 0; l < 4; l++)
+		{
+			uint64_t word;
+			std::memcpy(&word, bytes + 8 * l, 8);
+			_lanes[l] = rotateLeft(_lanes[l] ^ (word * 0x87C37B91114253D5ull),
+				31) * 0x4CF5AD432745937Full;
+		}
+	}
+
+public:
+	void update(const void* data, size_t size)
+	{
+		const uint8_t* bytes = (const uint8_t*) data;
+		_length += size;
+		if (_numPending > 0)
+		{
+			size_t n = std::min(sizeof(_pending) - _numPending, size);
+			std::memcpy(_pending + _numPending, bytes, n);
+			_numPending += n;
+			bytes += n;
+			size -= n;
+			if (_numPending < sizeof(_pending))
+			{
+				return;
+			}
+			block(_pending);
+			_numPending = 0;
+		}
+		for (; size >= sizeof(_pending); size -= sizeof(_pending))
+		{
+			block(bytes);
+			bytes += sizeof(_pending);
+		}
+		std::memcpy(_pending, bytes, size);
+		_numPending = size;
+	}
+
+	std::string finish()
+	{
+		if (_numPending > 0)
+		{
+			std::memset(_pending + _numPending, 0,
+				sizeof(_pending) - _numPending);
+			block(_pending);
+			_numPending = 0;
+		}
+		uint64_t high = mix(_lanes[0] ^ rotateLeft(_lanes[2], 17) ^ _length);
+		uint64_t low = mix(_lanes[1] ^ rotateLeft(_lanes[3], 43) ^ high);
+		char digits[33];
+		std::snprintf(digits, sizeof(digits), "%016llx%016llx",
+			(unsigned long long) high, (unsigned long long) low);
+		return digits;
+	}
+};
+
+std::string hashParameters(const std::vector<torch::Tensor>& params)
+{
+	Hasher hasher;
+	for (const torch::Tensor& param : params)
+	{
+		torch::Tensor values = param.to(torch::kCPU, torch::kFloat)
+			.contiguous();
+		hasher.update(values.data_ptr<float>(), values.numel() * sizeof(float));
+	}
+	return hasher.finish();
+}
+
+ObjectStore::ObjectStore(const std::string& outputFolder) :
+	_folder(outputFolder + "/objects")
+{}
+
+std::string ObjectStore::pathOf(const std::string& hash) const
+{
+	return _folder + "/" + hash + ".pth.tar";
+}
+
+bool ObjectStore::contains(const std::string& hash) const
+{
+	struct stat buffer;
+	return stat(pathOf(hash).c_str(), &buffer) == 0;
+}
+
+void ObjectStore::put(TrainingBrain& brain, const std::string& hash)
+{
+	if (contains(hash))
+	{
+		return;
+	}
+	std::string filepath = pathOf(hash);
+	std::string tmpFilepath = filepath + ".tmp";
+	std::remove(tmpFilepath.c_str());
+	brain.save(tmpFilepath);
+	// Brains without a module write nothing.
+	struct stat buffer;
+	if (stat(tmpFilepath.c_str(), &buffer) != 0)
+	{
+		return;
+	}
+	// Another trainer may have stored the same weights in the meantime.
+	if (std::rename(tmpFilepath.c_str(), filepath.c_str()) != 0)
+	{
+		std::remove(tmpFilepath.c_str());
+		if (!contains(hash))
+		{
+			throw std::runtime_error("Failed to rename " + tmpFilepath);
+		}
+	}
+}
+
+void ObjectStore::collectGarbage(const std::string& outputFolder)
+{
+	namespace fs = std::filesystem;
+
+	// The hash is the third word of a line of a manifest. Genomes can also
+	// start from an object, in a line "<id> checkpoint <filepath>".
+	std::unordered_set<std::string> referenced;
+	for (const fs::directory_entry& session : fs::directory_iterator(outputFolder))
+	{
+		if (!session.is_directory())
+		{
+			continue;
+		}
+		for (const fs::directory_entry& entry
+			: fs::directory_iterator(session.path()))
+		{
+			std::string filename = entry.path().filename().string();
+			if (entry.path().extension() == ".genome")
+			{
+				std::ifstream file(entry.path());
+				std::string line;
+				while (std::getline(file, line))
+				{
+					std::stringstream strm = std::stringstream(line);
+					std::string id;
+					std::string operation;
+					std::string checkpoint;
+					if (strm >> id >> operation && operation == "checkpoint")
+					{
+						strm >> std::ws;
+						std::getline(strm, checkpoint);
+						std::string name =
+							fs::path(checkpoint).filename().string();
+						referenced.insert(name.substr(0, name.find('.')));
+					}
+				}
+				continue;
+			}
+			if (filename.rfind("round", 0) != 0
+				|| entry.path().extension() != ".txt")
+			{
+				continue;
+			}
+			std::ifstream file(entry.path());
+			std::string line;
+			while (std::getline(file, line))
+			{
+				std::stringstream strm = std::stringstream(line);
+				std::string name;
+				std::string score;
+				std::string hash;
+				if (strm >> name >> score >> hash)
+				{
+					referenced.insert(hash);
+				}
+			}
+		}
+	}
+
+	size_t numKept = 0;
+	size_t numRemoved = 0;
+	uintmax_t numBytesRemoved = 0;
+	fs::path folder = fs::path(outputFolder) / "objects";
+	if (!fs::exists(folder))
+	{
+		std::cout << "No objects in " << outputFolder << std::endl;
+		return;
+	}
+	for (const fs::directory_entry& entry : fs::directory_iterator(folder))
+	{
+		std::string filename = entry.path().filename().string();
+		std::string hash = filename.substr(0, filename.find('.'));
+		if (referenced.count(hash))
+		{
+			numKept++;
+			continue;
+		}
+		numBytesRemoved += entry.file_size();
+		fs::remove(entry.path());
+		numRemoved++;
+	}
+	std::cout << "Removed " << numRemoved << " objects"
+		" (" << (numBytesRemoved / 1000000) << "MB)"
+		", kept " << numKept << "" << std::endl;
+}
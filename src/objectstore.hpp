@@ -0,0 +1,40 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include <torch/torch.h>
+
+class TrainingBrain;
+
+
+// A hash of the weights, as 32 hexadecimal digits. It is fast rather than
+// secure, because it only has to tell different weights apart.
+std::string hashParameters(const std::vector<torch::Tensor>& params);
+
+// Brain weights stored under the hash of their contents, shared by all
+// sessions in an output folder. Brains that survive from one save to the
+// next, or that were resumed, are only written once.
+class ObjectStore
+{
+private:
+	std::string _folder;
+
+public:
+	// The objects folder in the output folder must exist.
+	explicit ObjectStore(const std::string& outputFolder);
+
+	std::string pathOf(const std::string& hash) const;
+	bool contains(const std::string& hash) const;
+
+	// Saves the weights of the brain under the hash, unless they already are.
+	// Objects are written under a temporary name first, so an object that
+	// exists is always complete.
+	void put(TrainingBrain& brain, const std::string& hash);
+
+	// Removes the objects that no round manifest or genome of any session
+	// refers to.
+	// This must not run while a trainer saves into the same output folder,
+	// because its objects are written before its manifest.
+	static void collectGarbage(const std::string& outputFolder);
+};
@@ -0,0 +1,162 @@
+#include "parameterarena.hpp"
+
+#include <stdexcept>
+
+#include "module.hpp"
+
+
+// The number of floats in 64 bytes.
+constexpr size_t ALIGNMENT = 16;
+
+inline size_t alignedSize(size_t size)
+{
+	return (size + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+}
+
+const ArenaLayout& arenaLayout()
+{
+	static const ArenaLayout layout = []() {
+		ArenaLayout result;
+		Module prototype;
+		for (const auto& param : prototype.named_parameters())
+		{
+			const torch::Tensor& tensor = param.value();
+			std::vector<int64_t> shape;
+			for (int64_t d = 0; d < tensor.dim(); d++)
+			{
+				shape.push_back(tensor.size(d));
+			}
+			result.names.push_back(param.key());
+			result.shapes.push_back(shape);
+			result.offsets.push_back(result.rowSize);
+			result.rowSize += alignedSize(tensor.numel());
+		}
+		return result;
+	}();
+	return layout;
+}
+
+ParameterArena::ParameterArena(size_t numRows) :
+	// Torch aligns its allocations to 64 bytes, so every row is aligned too.
+	_rows(torch::zeros({int64_t(numRows), int64_t(arenaLayout().rowSize)},
+		torch::TensorOptions().device(torch::kCPU).dtype(torch::kFloat)))
+{}
+
+ParameterArena::ParameterArena(torch::Tensor rows) :
+	_rows(std::move(rows))
+{
+	if (_rows.dim() != 2
+		|| size_t(_rows.size(1)) != arenaLayout().rowSize
+		|| _rows.scalar_type() != torch::kFloat
+		|| !_rows.is_contiguous())
+	{
+		throw std::runtime_error("assertion failed");
+	}
+}
+
+torch::Tensor ParameterArena::view(const torch::Tensor& row, size_t i)
+{
+	const ArenaLayout& layout = arenaLayout();
+	int64_t numel = 1;
+	for (int64_t size : layout.shapes[i])
+	{
+		numel *= size;
+	}
+	return row.narrow(0, layout.offsets[i], numel).view(layout.shapes[i]);
+}
+
+void ParameterArena::adopt(Module& module)
+{
+	moveInto(module, /*keepValues=*/false);
+}
+
+void ParameterArena::bind(Module& module)
+{
+	moveInto(module, /*keepValues=*/true);
+}
+
+std::shared_ptr<Module> ParameterArena::bindNew()
+{
+	std::shared_ptr<Module> module(new Module(Module::UninitializedTag()));
+	moveInto(*module, /*keepValues=*/true);
+	module->matchOptionsToWeights();
+	return module;
+}
+
+void ParameterArena::moveInto(Module& module, bool keepValues)
+{
+	if (_numAdopted >= size_t(_rows.size(0)))
+	{
+		throw std::runtime_error("assertion failed");
+	}
+	torch::Tensor row = _rows[_numAdopted];
+	_numAdopted++;
+
+	torch::NoGradGuard no_grad;
+	std::vector<torch::Tensor> params = module.parameters();
+	if (params.size() != arenaLayout().offsets.size())
+	{
+		throw std::runtime_error("assertion failed");
+	}
+	for (size_t i = 0; i < params.size(); i++)
+	{
+		torch::Tensor& param = params[i];
+		torch::Tensor rowView = view(row, i);
+		if (!keepValues)
+		{
+			rowView.copy_(param);
+		}
+		param.set_data(rowView);
+	}
+	module._row = row;
+	module.forgetPackedWeights();
+}
+
+void ParameterArena::copyInto(size_t row, Module& module) const
+{
+	torch::NoGradGuard no_grad;
+	std::vector<torch::Tensor> params = module.parameters();
+	if (params.size() != arenaLayout().offsets.size())
+	{
+		throw std::runtime_error("assertion failed");
+	}
+	for (size_t i = 0; i < params.size(); i++)
+	{
+		params[i].copy_(view(_rows[row], i));
+	}
+}
+
+size_t ParameterArena::rowOf(const Module& module) const
+{
+	if (!module._row.defined())
+	{
+		return numRows();
+	}
+	const float* first = _rows.data_ptr<float>();
+	const float* row = module._row.data_ptr<float>();
+	if (row < first || row >= first + numRows() * arenaLayout().rowSize)
+	{
+		return numRows();
+	}
+	return size_t(row - first) / arenaLayout().rowSize;
+}
+
+torch::Tensor ParameterArena::stackedView(size_t i) const
+{
+	const ArenaLayout& layout = arenaLayout();
+	std::vector<int64_t> sizes = { _rows.size(0) };
+	std::vector<int64_t> strides = { int64_t(layout.rowSize) };
+	int64_t stride = 1;
+	for (int64_t size : layout.shapes[i])
+	{
+		sizes.push_back(size);
+	}
+	strides.resize(sizes.size());
+	for (size_t d = sizes.size() - 1; d > 0; d--)
+	{
+		strides[d] = stride;
+		stride *= sizes[d];
+	}
+	return _rows.as_strided(sizes, strides,
+		_rows.storage_offset() + int64_t(layout.offsets[i]));
+}
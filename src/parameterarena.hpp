@@ -0,0 +1,79 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <torch/torch.h>
+
+class Module;
+
+
+// Where the parameters of a module go in a row of a ParameterArena, in the
+// order of Module::parameters(). Offsets and sizes are in floats.
+struct ArenaLayout
+{
+	std::vector<std::string> names;
+	std::vector<std::vector<int64_t>> shapes;
+	std::vector<size_t> offsets;
+	size_t rowSize = 0;
+};
+
+const ArenaLayout& arenaLayout();
+
+// The parameters of the brains of one personality, stored as the rows of a
+// single matrix. Each row holds the parameters of one module, each starting
+// on a 64-byte boundary, and the modules in the arena only hold views of
+// their row.
+class ParameterArena
+{
+private:
+	torch::Tensor _rows;
+	size_t _numAdopted = 0;
+
+public:
+	explicit ParameterArena(size_t numRows);
+	// Uses the given rows, which must be laid out as in arenaLayout().
+	explicit ParameterArena(torch::Tensor rows);
+	ParameterArena(const ParameterArena&) = delete;
+	ParameterArena(ParameterArena&& other) = delete;
+	ParameterArena& operator=(const ParameterArena&) = delete;
+	ParameterArena& operator=(ParameterArena&&) = delete;
+	~ParameterArena() = default;
+
+	// Copies the parameters of the module into the next free row and makes
+	// them views of that row. The module must be a float module on the CPU.
+	void adopt(Module& module);
+	// Makes the parameters of the module views of the next free row,
+	// taking the values that are already in the row.
+	void bind(Module& module);
+	// Makes a module whose parameters are views of the next free row, taking
+	// the values that are already in the row without initializing others.
+	std::shared_ptr<Module> bindNew();
+	// Copies a row into the parameters of a module that is not in an arena,
+	// on any device.
+	void copyInto(size_t row, Module& module) const;
+
+	// The row that the parameters of the module are views of,
+	// or the number of rows if the module is not in this arena.
+	size_t rowOf(const Module& module) const;
+	// One parameter of every row as a single tensor [row, ...],
+	// without copying anything.
+	torch::Tensor stackedView(size_t i) const;
+
+	size_t numRows() const
+	{
+		return size_t(_rows.size(0));
+	}
+
+	// All rows, including the padding between the parameters.
+	const torch::Tensor& rows() const
+	{
+		return _rows;
+	}
+
+private:
+	void moveInto(Module& module, bool keepValues);
+	static torch::Tensor view(const torch::Tensor& row, size_t i);
+};
@@ -0,0 +1,125 @@
+#include "personalitybatch.hpp"
+
+#include <algorithm>
+
+#include "const.hpp"
+#include "parameterarena.hpp"
+#include "trace.hpp"
+#include "trainingbrain.hpp"
+
+
+void PersonalityBatch::stack(const std::vector<TrainingBrain*>& brains,
+	const ParameterArena* arena)
+{
+	_brains = brains;
+	_weights.clear();
+	_biases.clear();
+	if (_brains.empty())
+	{
+		return;
+	}
+	if (arena && stackViews(*arena))
+	{
+		return;
+	}
+
+	// The parameters come in pairs of weight and bias, one pair per layer.
+	std::vector<std::vector<torch::Tensor>> paramsPerBrain;
+	for (TrainingBrain* brain : _brains)
+	{
+		paramsPerBrain.push_back(brain->parameters());
+	}
+	for (size_t k = 0; k + 1 < paramsPerBrain[0].size(); k += 2)
+	{
+		std::vector<torch::Tensor> weights;
+		std::vector<torch::Tensor> biases;
+		for (const auto& params : paramsPerBrain)
+		{
+			weights.push_back(params[k].t());
+			biases.push_back(params[k + 1].unsqueeze(0));
+		}
+		_weights.push_back(torch::stack(weights).contiguous());
+		_biases.push_back(torch::stack(biases));
+	}
+}
+
+bool PersonalityBatch::stackViews(const ParameterArena& arena)
+{
+	// Order the brains as their rows, so that brain i uses row i.
+	if (_brains.size() != arena.numRows())
+	{
+		return false;
+	}
+	std::vector<TrainingBrain*> brainPerRow(arena.numRows(), nullptr);
+	for (TrainingBrain* brain : _brains)
+	{
+		size_t row = brain->rowIn(arena);
+		if (row >= arena.numRows() || brainPerRow[row])
+		{
+			return false;
+		}
+		brainPerRow[row] = brain;
+	}
+	_brains = brainPerRow;
+
+	// The parameters come in pairs of weight [out, in] and bias [out].
+	size_t numParameters = arenaLayout().offsets.size();
+	for (size_t k = 0; k + 1 < numParameters; k += 2)
+	{
+		_weights.push_back(arena.stackedView(k).transpose(1, 2));
+		_biases.push_back(arena.stackedView(k + 1).unsqueeze(1));
+	}
+	return true;
+}
+
+void PersonalityBatch::evaluate(size_t seat)
+{
+	TRACE_SCOPE("PersonalityBatch::evaluate");
+	size_t numRows = 0;
+	for (TrainingBrain* brain : _brains)
+	{
+		numRows = std::max(numRows, brain->numGamesPerSeat[seat]);
+	}
+	if (numRows == 0)
+	{
+		return;
+	}
+
+	if (!_inputStorage.defined() || size_t(_inputStorage.size(1)) < numRows)
+	{
+		size_t capacity = numRows + numRows / 8 + 1;
+		_inputStorage = torch::zeros(
+			{int(_brains.size()), int(capacity), int(NUM_VIEW_SETS * NUM_CARDS)},
+			_weights[0].options());
+	}
+	// The padding rows keep whatever views they held before. Their outputs
+	// are computed but never copied back.
+	torch::Tensor input = _inputStorage.narrow(1, 0, numRows);
+	for (size_t i = 0; i < _brains.size(); i++)
+	{
+		size_t n = _brains[i]->numGamesPerSeat[seat];
+		if (n == 0) continue;
+		input[i].narrow(0, 0, n).copy_(_brains[i]->viewTensorPerSeat[seat]);
+	}
+
+	torch::Tensor s = input;
+	for (size_t l = 0; l < _weights.size(); l++)
+	{
+		s = torch::baddbmm(_biases[l], s, _weights[l]);
+		if (l + 1 < _weights.size())
+		{
+			s.relu_();
+		}
+		else
+		{
+			s.sigmoid_();
+		}
+	}
+
+	for (size_t i = 0; i < _brains.size(); i++)
+	{
+		size_t n = _brains[i]->numGamesPerSeat[seat];
+		if (n == 0) continue;
+		_brains[i]->outputTensorPerSeat[seat].copy_(s[i].narrow(0, 0, n));
+	}
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <vector>
+
+#include <torch/torch.h>
+
+class ParameterArena;
+class TrainingBrain;
+
+
+// Evaluates all brains of a personality at once. Their weights are stacked
+// so that every layer is a single batched matrix multiplication over
+// [brain, game, feature] instead of one small multiplication per brain.
+class PersonalityBatch
+{
+private:
+	std::vector<TrainingBrain*> _brains;
+	// Per layer, the transposed weights [brain, in, out]
+	// and the biases [brain, 1, out] of all brains.
+	std::vector<torch::Tensor> _weights;
+	std::vector<torch::Tensor> _biases;
+	// The views of all brains, padded to the largest batch.
+	torch::Tensor _inputStorage;
+
+public:
+	// If every row of the arena holds one of the brains, the stacked weights
+	// are views of the arena and follow its changes. Otherwise the weights
+	// are copied, so this has to be called again whenever they change.
+	void stack(const std::vector<TrainingBrain*>& brains,
+		const ParameterArena* arena = nullptr);
+	void evaluate(size_t seat);
+
+private:
+	bool stackViews(const ParameterArena& arena);
+};
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+
+// The Philox4x32-10 counter-based generator (Salmon et al., 2011).
+// Each counter gives four random words on its own, so any part of a stream
+// can be generated in any order, and in parallel, from just the key.
+using PhiloxCounter = std::array<uint32_t, 4>;
+
+inline PhiloxCounter philox(PhiloxCounter counter, uint64_t key)
+{
+	uint32_t k0 = uint32_t(key);
+	uint32_t k1 = uint32_t(key >> 32);
+	for (int round = 0; round < 10; round++)
+	{
+		uint64_t product0 = uint64_t(0xD2511F53) * counter[0];
+		uint64_t product1 = uint64_t(0xCD9E8D57) * counter[2];
+		counter = {
+			uint32_t(product1 >> 32) ^ counter[1] ^ k0,
+			uint32_t(product1),
+			uint32_t(product0 >> 32) ^ counter[3] ^ k1,
+			uint32_t(product0),
+		};
+		k0 += 0x9E3779B9;
+		k1 += 0xBB67AE85;
+	}
+	return counter;
+}
@@ -0,0 +1,254 @@
+#include "populationfile.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+
+#ifdef _MSC_VER
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "parameterarena.hpp"
+#include "trainingbrain.hpp"
+
+
+void writePopulationFile(const std::string& filepath, size_t round,
+	const std::vector<const TrainingBrain*>& brains)
+{
+	const ArenaLayout& layout = arenaLayout();
+
+	PopulationHeader header = {};
+	std::memcpy(header.magic, POPULATION_MAGIC, sizeof(header.magic));
+	header.version = POPULATION_VERSION;
+	header.dtype = POPULATION_DTYPE_FLOAT32;
+	header.round = round;
+	header.numParameters = layout.offsets.size();
+	header.numBrains = brains.size();
+	header.rowSize = layout.rowSize;
+	// The records are 64 bytes each, so the weights are aligned already.
+	header.weightsOffset = sizeof(PopulationHeader)
+		+ header.numParameters * sizeof(ParameterRecord)
+		+ header.numBrains * sizeof(BrainRecord);
+
+	std::vector<ParameterRecord> parameterRecords(header.numParameters);
+	for (size_t i = 0; i < parameterRecords.size(); i++)
+	{
+		ParameterRecord& record = parameterRecords[i];
+		std::strncpy(record.name, layout.names[i].c_str(),
+			sizeof(record.name) - 1);
+		record.numDimensions = layout.shapes[i].size();
+		for (size_t d = 0; d < layout.shapes[i].size() && d < 2; d++)
+		{
+			record.shape[d] = layout.shapes[i][d];
+		}
+		record.offset = layout.offsets[i];
+	}
+
+	std::vector<BrainRecord> brainRecords(header.numBrains);
+	size_t numRows = 0;
+	for (size_t i = 0; i < brains.size(); i++)
+	{
+		const TrainingBrain& brain = *brains[i];
+		BrainRecord& record = brainRecords[i];
+		record.personality = uint32_t(brain.personality);
+		record.serialNumber = brain.serialNumber;
+		record.motherNumber = brain.motherNumber;
+		record.fatherNumber = brain.fatherNumber;
+		record.objectiveScore = brain.objectiveScore;
+		if (!brain.parameters().empty())
+		{
+			record.hasWeights = 1;
+			record.row = numRows;
+			numRows++;
+		}
+	}
+
+	std::ofstream file(filepath, std::ofstream::binary);
+	file.write((const char*) &header, sizeof(header));
+	file.write((const char*) parameterRecords.data(),
+		parameterRecords.size() * sizeof(ParameterRecord));
+	file.write((const char*) brainRecords.data(),
+		brainRecords.size() * sizeof(BrainRecord));
+
+	std::vector<float> row(layout.rowSize);
+	for (const TrainingBrain* brain : brains)
+	{
+		std::vector<torch::Tensor> params = brain->parameters();
+		if (params.empty())
+		{
+			continue;
+		}
+		if (params.size() != layout.offsets.size())
+		{
+			throw std::runtime_error("assertion failed");
+		}
+		std::fill(row.begin(), row.end(), 0.0f);
+		for (size_t i = 0; i < params.size(); i++)
+		{
+			torch::Tensor param = params[i].to(torch::kCPU, torch::kFloat)
+				.contiguous();
+			std::memcpy(&row[layout.offsets[i]], param.data_ptr<float>(),
+				param.numel() * sizeof(float));
+		}
+		file.write((const char*) row.data(), row.size() * sizeof(float));
+	}
+
+	file.close();
+	if (!file)
+	{
+		std::cerr << "Failed to write " << filepath << std::endl;
+		throw std::runtime_error("Failed to write " + filepath);
+	}
+}
+
+class MappedFile
+{
+public:
+	void* data = nullptr;
+	size_t size = 0;
+
+	explicit MappedFile(const std::string& filepath)
+	{
+#ifdef _MSC_VER
+		HANDLE file = CreateFileA(filepath.c_str(), GENERIC_READ,
+			FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL,
+			nullptr);
+		if (file == INVALID_HANDLE_VALUE)
+		{
+			throw std::runtime_error("Failed to open " + filepath);
+		}
+		LARGE_INTEGER fileSize;
+		GetFileSizeEx(file, &fileSize);
+		size = fileSize.QuadPart;
+		// Copy on write, so that brains can change their rows.
+		HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_WRITECOPY,
+			0, 0, nullptr);
+		CloseHandle(file);
+		if (mapping == nullptr)
+		{
+			throw std::runtime_error("Failed to map " + filepath);
+		}
+		data = MapViewOfFile(mapping, FILE_MAP_COPY, 0, 0, 0);
+		CloseHandle(mapping);
+		if (data == nullptr)
+		{
+			throw std::runtime_error("Failed to map " + filepath);
+		}
+#else
+		int fd = open(filepath.c_str(), O_RDONLY);
+		if (fd < 0)
+		{
+			throw std::runtime_error("Failed to open " + filepath);
+		}
+		struct stat buffer;
+		if (fstat(fd, &buffer) != 0)
+		{
+			close(fd);
+			throw std::runtime_error("Failed to open " + filepath);
+		}
+		size = buffer.st_size;
+		// Copy on write, so that brains can change their rows.
+		data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+		close(fd);
+		if (data == MAP_FAILED)
+		{
+			data = nullptr;
+			throw std::runtime_error("Failed to map " + filepath);
+		}
+#endif
+	}
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	~MappedFile()
+	{
+#ifdef _MSC_VER
+		UnmapViewOfFile(data);
+#else
+		munmap(data, size);
+#endif
+	}
+};
+
+PopulationFile::PopulationFile(const std::string& filepath) :
+	_file(std::make_shared<MappedFile>(filepath))
+{
+	const char* bytes = (const char*) _file->data;
+	const ArenaLayout& layout = arenaLayout();
+	auto invalid = [&]() {
+		std::cerr << "Invalid population file " << filepath << std::endl;
+		return std::runtime_error("Invalid population file " + filepath);
+	};
+
+	if (_file->size < sizeof(PopulationHeader))
+	{
+		throw invalid();
+	}
+	_header = (const PopulationHeader*) bytes;
+	if (std::memcmp(_header->magic, POPULATION_MAGIC, sizeof(_header->magic))
+		|| _header->version != POPULATION_VERSION
+		|| _header->dtype != POPULATION_DTYPE_FLOAT32
+		|| _header->numParameters != layout.offsets.size()
+		|| _header->rowSize != layout.rowSize
+		|| _header->weightsOffset % 64 != 0
+		|| _header->weightsOffset < sizeof(PopulationHeader)
+			+ _header->numParameters * sizeof(ParameterRecord)
+			+ _header->numBrains * sizeof(BrainRecord)
+		|| _header->weightsOffset > _file->size)
+	{
+		throw invalid();
+	}
+
+	const ParameterRecord* parameters = (const ParameterRecord*)
+		(bytes + sizeof(PopulationHeader));
+	for (size_t i = 0; i < _header->numParameters; i++)
+	{
+		const ParameterRecord& record = parameters[i];
+		const std::vector<int64_t>& shape = layout.shapes[i];
+		if (record.offset != layout.offsets[i]
+			|| record.numDimensions != shape.size()
+			|| shape.size() > 2
+			|| !std::equal(shape.begin(), shape.end(), record.shape))
+		{
+			throw invalid();
+		}
+	}
+
+	_brains = (const BrainRecord*) (parameters + _header->numParameters);
+	size_t numRows = (_file->size - _header->weightsOffset)
+		/ (_header->rowSize * sizeof(float));
+	for (size_t i = 0; i < _header->numBrains; i++)
+	{
+		if (_brains[i].hasWeights && _brains[i].row >= numRows)
+		{
+			throw invalid();
+		}
+	}
+}
+
+torch::Tensor PopulationFile::rows(size_t first, size_t count) const
+{
+	size_t rowSize = _header->rowSize;
+	size_t numRows = (_file->size - _header->weightsOffset)
+		/ (rowSize * sizeof(float));
+	if (first + count > numRows)
+	{
+		throw std::runtime_error("assertion failed");
+	}
+	float* weights = (float*) ((char*) _file->data + _header->weightsOffset);
+	// The tensor keeps the file mapped.
+	std::shared_ptr<MappedFile> file = _file;
+	return torch::from_blob(weights + first * rowSize,
+		{int64_t(count), int64_t(rowSize)},
+		[file](void*) {},
+		torch::TensorOptions().dtype(torch::kFloat));
+}
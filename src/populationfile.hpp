@@ -0,0 +1,99 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <torch/torch.h>
+
+class TrainingBrain;
+
+
+// A whole population in a single file, which can be mapped into memory and
+// used as is. The file starts with a PopulationHeader, followed by a
+// ParameterRecord for each parameter of a module and a BrainRecord for each
+// brain. The weights follow from weightsOffset, which is a multiple of 64,
+// as one row of rowSize floats per neural brain, laid out like the rows of
+// a ParameterArena. The rows of each personality are consecutive.
+// Numbers are stored as they are in memory, which is little-endian.
+constexpr char POPULATION_MAGIC[8] = {
+	'M', 'N', 'P', 'O', 'P', 'U', 'L', '\n' };
+constexpr uint32_t POPULATION_VERSION = 1;
+constexpr uint32_t POPULATION_DTYPE_FLOAT32 = 0;
+
+struct PopulationHeader
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t dtype;
+	uint64_t round;
+	uint32_t numParameters;
+	uint32_t numBrains;
+	uint64_t rowSize;
+	uint64_t weightsOffset;
+	uint8_t reserved[16];
+};
+
+struct ParameterRecord
+{
+	char name[32];
+	uint32_t numDimensions;
+	uint32_t reserved;
+	int64_t shape[2];
+	uint64_t offset;
+};
+
+struct BrainRecord
+{
+	uint32_t personality;
+	uint32_t hasWeights;
+	uint64_t serialNumber;
+	uint64_t motherNumber;
+	uint64_t fatherNumber;
+	// The index of its row of weights, if it has weights.
+	uint64_t row;
+	float objectiveScore;
+	uint8_t reserved[20];
+};
+
+static_assert(sizeof(PopulationHeader) == 64, "header must be 64 bytes");
+static_assert(sizeof(ParameterRecord) == 64, "records must be 64 bytes");
+static_assert(sizeof(BrainRecord) == 64, "records must be 64 bytes");
+
+// Writes the brains in the given order, which must keep the brains of each
+// personality together.
+void writePopulationFile(const std::string& filepath, size_t round,
+	const std::vector<const TrainingBrain*>& brains);
+
+class MappedFile;
+
+// A population file mapped into memory. Writing to the rows changes the
+// mapped pages of this process only, not the file.
+class PopulationFile
+{
+private:
+	std::shared_ptr<MappedFile> _file;
+	const PopulationHeader* _header = nullptr;
+	const BrainRecord* _brains = nullptr;
+
+public:
+	// Throws if the file cannot be mapped, or does not match the layout of
+	// the modules of this build.
+	explicit PopulationFile(const std::string& filepath);
+
+	const PopulationHeader& header() const
+	{
+		return *_header;
+	}
+
+	const BrainRecord& brain(size_t i) const
+	{
+		return _brains[i];
+	}
+
+	// Consecutive rows of weights as a [count, rowSize] tensor that uses
+	// the mapped memory, which stays mapped for as long as it is used.
+	torch::Tensor rows(size_t first, size_t count) const;
+};
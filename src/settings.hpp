@@ -0,0 +1,190 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "const.hpp"
+
+
+// How the first layer is evaluated on the CPU.
+// The views are mostly zeros and ones, so summing the weight columns of
+// the set entries is much cheaper than a dense matrix multiplication.
+enum class FirstLayerMode
+{
+	DENSE,
+	SPARSE,
+	// Evaluate both and stop if they disagree.
+	VERIFY,
+};
+
+// Which code runs the networks on the CPU.
+enum class InferenceKernel
+{
+	TORCH,
+	// Our own kernel that runs all layers in one go.
+	FUSED,
+	// Run both and stop if they disagree.
+	VERIFY,
+	// The fused kernel with int8 weights.
+	QUANTIZED,
+};
+
+// Options that can be changed per run from the command line.
+struct Settings
+{
+	FirstLayerMode firstLayerMode = FirstLayerMode::DENSE;
+	// Evaluate all brains of a personality together.
+	bool batchedInference = false;
+	InferenceKernel inferenceKernel = InferenceKernel::TORCH;
+	// Only compute the outputs of the legal actions with the fused kernel,
+	// except in rounds that track correlation, which need all of them.
+	bool legalActionsOnly = false;
+	// Start games in different steps and seat each brain so that it plays
+	// all of its games in the same steps, for fewer and larger batches.
+	bool staggeredSeats = false;
+	// Let each game move on as soon as its brain has evaluated it, instead
+	// of waiting for all games at every turn. A brain evaluates its queued
+	// games once it has targetBatchSize of them, or once the oldest one
+	// has waited for batchDeadlineMicroseconds.
+	bool dynamicBatching = false;
+	size_t maxGamesInFlight = 4096;
+	size_t targetBatchSize = 64;
+	size_t batchDeadlineMicroseconds = 200;
+	// With a fixed seed, the same build on the same machine plays the same
+	// games, except where brains evaluate in parallel and draw from
+	// torch's shared generator.
+	bool fixedSeed = false;
+	uint32_t seed = 0;
+	// Save brains as the steps that made them from an earlier checkpoint,
+	// writing the weights of a saved brain if it has no genome yet or if
+	// replaying it would take more than maxGenomeSteps distinct steps.
+	// Only on the CPU.
+	bool genomes = false;
+	size_t maxGenomeSteps = 64;
+	// Also save each checkpoint as a single population file, which resuming
+	// prefers because it can map it into memory instead of loading it.
+	bool populationFiles = false;
+	// Only write the population file of the resumed round, then stop.
+	bool convertOnly = false;
+	// Save weights by the hash of their contents, in an objects folder shared
+	// by all sessions, so that unchanged brains are only written once.
+	bool objectStore = false;
+	// Only remove the objects that no manifest refers to, then stop.
+	bool collectGarbage = false;
+	size_t numGamesPerBrain = 1000;
+	size_t lastRound = 10000;
+	std::string outputFolder = BRAIN_OUTPUT_FOLDER;
+	// Rounds to write a Chrome trace of.
+	std::vector<size_t> tracedRounds;
+
+	static Settings parse(int argc, char* argv[])
+	{
+		Settings settings;
+		for (int i = 1; i < argc; i++)
+		{
+			if (strcmp(argv[i], "--sparse") == 0)
+			{
+				settings.firstLayerMode = FirstLayerMode::SPARSE;
+			}
+			else if (strcmp(argv[i], "--verify-sparse") == 0)
+			{
+				settings.firstLayerMode = FirstLayerMode::VERIFY;
+			}
+			else if (strcmp(argv[i], "--batched") == 0)
+			{
+				settings.batchedInference = true;
+			}
+			else if (strcmp(argv[i], "--fused") == 0)
+			{
+				settings.inferenceKernel = InferenceKernel::FUSED;
+			}
+			else if (strcmp(argv[i], "--verify-fused") == 0)
+			{
+				settings.inferenceKernel = InferenceKernel::VERIFY;
+			}
+			else if (strcmp(argv[i], "--int8") == 0)
+			{
+				settings.inferenceKernel = InferenceKernel::QUANTIZED;
+			}
+			else if (strcmp(argv[i], "--legal-only") == 0)
+			{
+				settings.legalActionsOnly = true;
+			}
+			else if (strcmp(argv[i], "--staggered") == 0)
+			{
+				settings.staggeredSeats = true;
+			}
+			else if (strcmp(argv[i], "--dynamic") == 0)
+			{
+				settings.dynamicBatching = true;
+			}
+			else if (strcmp(argv[i], "--in-flight") == 0 && i + 1 < argc)
+			{
+				settings.maxGamesInFlight = strtoul(argv[++i], nullptr, 10);
+			}
+			else if (strcmp(argv[i], "--batch-size") == 0 && i + 1 < argc)
+			{
+				settings.targetBatchSize = strtoul(argv[++i], nullptr, 10);
+			}
+			else if (strcmp(argv[i], "--batch-deadline-us") == 0 && i + 1 < argc)
+			{
+				settings.batchDeadlineMicroseconds =
+					strtoul(argv[++i], nullptr, 10);
+			}
+			else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc)
+			{
+				settings.fixedSeed = true;
+				settings.seed = strtoul(argv[++i], nullptr, 10);
+			}
+			else if (strcmp(argv[i], "--genomes") == 0)
+			{
+				settings.genomes = true;
+			}
+			else if (strcmp(argv[i], "--genome-steps") == 0 && i + 1 < argc)
+			{
+				settings.maxGenomeSteps = strtoul(argv[++i], nullptr, 10);
+			}
+			else if (strcmp(argv[i], "--population-file") == 0)
+			{
+				settings.populationFiles = true;
+			}
+			else if (strcmp(argv[i], "--convert") == 0)
+			{
+				settings.convertOnly = true;
+			}
+			else if (strcmp(argv[i], "--object-store") == 0)
+			{
+				settings.objectStore = true;
+			}
+			else if (strcmp(argv[i], "--gc") == 0)
+			{
+				settings.collectGarbage = true;
+			}
+			else if (strcmp(argv[i], "--games-per-brain") == 0 && i + 1 < argc)
+			{
+				settings.numGamesPerBrain = strtoul(argv[++i], nullptr, 10);
+			}
+			else if (strcmp(argv[i], "--last-round") == 0 && i + 1 < argc)
+			{
+				settings.lastRound = strtoul(argv[++i], nullptr, 10);
+			}
+			else if (strcmp(argv[i], "--output") == 0 && i + 1 < argc)
+			{
+				settings.outputFolder = argv[++i];
+			}
+			else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc)
+			{
+				settings.tracedRounds.push_back(strtoul(argv[++i], nullptr, 10));
+			}
+			else
+			{
+				std::cerr << "Ignoring unknown option " << argv[i] << std::endl;
+			}
+		}
+		return settings;
+	}
+};
@@ -0,0 +1,457 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <iostream>
+#include <stdexcept>
+#include <vector>
+
+#include "action.hpp"
+#include "const.hpp"
+#include "gamestate.hpp"
+#include "gametable.hpp"
+#include "handvalue.hpp"
+#include "trace.hpp"
+#include "trainingbrain.hpp"
+
+// The per-game steps of a round. These live in a header so that they are
+// inlined into the trainer's loops and can also be measured on their own.
+
+
+inline float determineHandValue(const GameTable& games, size_t g,
+	size_t s, uint64_t cards);
+
+inline void debugPrintCard(size_t card)
+{
+	if (card >= NUM_SUITS * NUM_FACES_PER_SUIT)
+	{
+		switch (card - NUM_SUITS * NUM_FACES_PER_SUIT)
+		{
+			case 0: std::cout << "CAf"; return; break;
+			case 1: std::cout << "JKR"; return; break;
+			case 2: std::cout << "H12"; return; break;
+			case 3: std::cout << "SAf"; return; break;
+		}
+	}
+	const char* SUITS[NUM_SUITS] = {"C", "D", "H", "S"};
+	const char* FACES[NUM_FACES_PER_SUIT] = {"7", "8", "9", "10",
+		"J", "Q", "K", "A"};
+	std::cout << SUITS[card % NUM_SUITS] << FACES[card / NUM_SUITS];
+}
+
+inline void debugPrintGameState(const GameTable& games, size_t g,
+	bool full = false)
+{
+	const GameState& state = games.state[g];
+	std::cout << "----------------------" << std::endl;
+	std::cout << "Table: ";
+	for (uint64_t cards = state.table(); cards != 0; )
+	{
+		debugPrintCard(popLowestCard(cards));
+		std::cout << " ";
+	}
+	std::cout << std::endl;
+	for (size_t s = 0; s < NUM_SEATS; s++)
+	{
+		if (games.personality(g, s) == Personality::EMPTY)
+		{
+			continue;
+		}
+		std::cout << "Seat " << s << ""
+			" (" << TrainingBrain::personalityName(
+				games.personality(g, s)) << ")"
+			": ";
+		for (uint64_t cards = state.hand(s); cards != 0; )
+		{
+			size_t c = popLowestCard(cards);
+			debugPrintCard(c);
+			if (state.vision(s) & cardBit(c))
+			{
+				std::cout << "*";
+			}
+			std::cout << " ";
+		}
+		if (games.hasPassed(g, s))
+		{
+			std::cout << " <passed>";
+		}
+		std::cout << "   " << determineHandValue(games, g, s, state.hand(s));
+		std::cout << "   discarded: ";
+		for (uint64_t cards = state.vision(s) & ~state.hand(s); cards != 0; )
+		{
+			debugPrintCard(popLowestCard(cards));
+			std::cout << " ";
+		}
+		std::cout << std::endl;
+	}
+	if (full)
+	{
+		for (size_t i = 0; i < NUM_STATE_SETS * NUM_CARDS; i++)
+		{
+			if (i > 0 && i % NUM_CARDS == 0)
+			{
+				std::cout << std::endl;
+			}
+			else if (i > 0 && (i % NUM_CARDS) % NUM_SUITS == 0)
+			{
+				std::cout << "  ";
+			}
+			std::cout << int((state.sets[i / NUM_CARDS] >> (i % NUM_CARDS)) & 1)
+				<< " ";
+		}
+		std::cout << std::endl;
+	}
+	std::cout << "----------------------" << std::endl;
+}
+
+inline void assertCorrectGameState(const GameTable& games, size_t g)
+{
+	const GameState& state = games.state[g];
+	uint64_t used = 0;
+	for (size_t hand = 0; hand < NUM_SEATS + 1; hand++)
+	{
+		uint64_t overlap = used & state.sets[hand];
+		if (overlap != 0)
+		{
+			debugPrintGameState(games, g, /*full=*/true);
+			std::cerr << "card " << lowestCard(overlap) << " used twice"
+				<< std::endl;
+			throw std::runtime_error("assertion failed");
+		}
+		used |= state.sets[hand];
+	}
+	if (countCards(used) != NUM_CARDS_PER_HAND * (NUM_SEATS + 1))
+	{
+		debugPrintGameState(games, g, /*full=*/true);
+		std::cerr << "cards missing" << std::endl;
+		throw std::runtime_error("assertion failed");
+	}
+}
+
+inline void updateGameState(GameTable& games, size_t g,
+	size_t activeSeat, TrainingBrain* const* brains, TrainingTally* tallies)
+{
+	if (games.hasPassed(g, activeSeat))
+	{
+		return;
+	}
+
+	GameState& state = games.state[g];
+	size_t slot = games.slotOfSeat[g][activeSeat];
+	TrainingBrain* brain = brains[slot];
+	size_t offset = games.relativeGameOffset[g][activeSeat];
+	const float* output = &brain->outputBufferPerSeat[
+		games.batchOf(g, activeSeat)][offset * ACTION_SIZE];
+	Action action = decodeAction(output, state.table(),
+		state.hand(activeSeat));
+	float passWeight = action.passWeight;
+	bool swapOnPass = action.swapOnPass;
+	size_t tableCard = action.tableCard;
+	float tableCardWeight = action.tableCardWeight;
+	size_t ownCard = action.ownCard;
+	float ownCardWeight = action.ownCardWeight;
+
+	if (games.personality(g, activeSeat) == Personality::GREEDY)
+	{
+		// Exchanging a table card and an own card toggles both bits
+		// in both the table and the hand, so we can try out every move
+		// without touching the game state.
+		uint64_t hand = state.hand(activeSeat);
+		passWeight = determineHandValue(games, g, activeSeat, hand);
+		tableCardWeight = 0;
+		uint64_t tableCards = 0;
+		uint64_t ownCards = 0;
+		for (uint64_t cards = state.table() | hand; cards != 0; )
+		{
+			size_t c = popLowestCard(cards);
+			if (state.table() & cardBit(c))
+			{
+				tableCards |= cardBit(c);
+				for (uint64_t xs = ownCards; xs != 0; )
+				{
+					size_t x = popLowestCard(xs);
+					float value = determineHandValue(games, g, activeSeat,
+						hand ^ (cardBit(c) | cardBit(x)));
+					if (value > tableCardWeight)
+					{
+						tableCard = c;
+						ownCard = x;
+						tableCardWeight = value;
+					}
+				}
+			}
+			else
+			{
+				ownCards |= cardBit(c);
+				for (uint64_t xs = tableCards; xs != 0; )
+				{
+					size_t x = popLowestCard(xs);
+					float value = determineHandValue(games, g, activeSeat,
+						hand ^ (cardBit(c) | cardBit(x)));
+					if (value > passWeight)
+					{
+						ownCard = c;
+						tableCard = x;
+						tableCardWeight = value;
+					}
+				}
+			}
+		}
+		{
+			// Swapping with the table gives us the table as our hand.
+			float value = determineHandValue(games, g, activeSeat, state.table());
+			if (value >= 25 && value > passWeight && value > tableCardWeight)
+			{
+				swapOnPass = true;
+				passWeight = value;
+			}
+		}
+		// If we can make a move without losing much value, keep playing.
+		if (passWeight < 14 || tableCardWeight + 1 > passWeight)
+		{
+			passWeight = -1;
+		}
+		ownCardWeight = tableCardWeight;
+	}
+
+	if (tableCardWeight > passWeight && ownCardWeight > passWeight)
+	{
+		tallies[slot].totalConfidence +=
+			std::max(0.0f,
+				std::min(std::min(tableCardWeight, ownCardWeight), 1.0f));
+
+		// Normal move.
+		uint64_t exchanged = cardBit(tableCard) | cardBit(ownCard);
+		state.table() ^= exchanged;
+		state.hand(activeSeat) ^= exchanged;
+		state.vision(activeSeat) |= exchanged;
+
+		// If all players but one have passed, the game ends after
+		// that player's next turn.
+		if (games.numPassed(g) == NUM_SEATS - 1)
+		{
+			games.passedSeats[g] |= (1 << activeSeat);
+		}
+	}
+	else
+	{
+		tallies[slot].totalConfidence +=
+			std::max(0.0f, std::min(passWeight, 1.0f));
+
+		if (swapOnPass)
+		{
+			// Swap with the table.
+			uint64_t table = state.table();
+			state.vision(activeSeat) |= table | state.hand(activeSeat);
+			state.table() = state.hand(activeSeat);
+			state.hand(activeSeat) = table;
+		}
+
+		games.passedSeats[g] |= (1 << activeSeat);
+		if (swapOnPass)
+		{
+			games.swappedSeats[g] |= (1 << activeSeat);
+		}
+	}
+
+	// If a player makes 31, the game ends immediately.
+	if (determineHandValue(games, g, activeSeat, state.hand(activeSeat))
+		>= 31.0f)
+	{
+		games.passedSeats[g] = (1 << NUM_SEATS) - 1;
+	}
+}
+
+// Records the turn in which players passed, after the player in seat s took
+// turn t. Finished games are no longer visited, so the other players pass
+// on their next turn now, as they would when playing on. After the last
+// turn, that is maxTurnsPerPlayer, as for games that never finish.
+inline void updateTurnsOfPass(GameTable& games, size_t g, size_t s, size_t t)
+{
+	if (games.hasPassed(g, s) && games.turnOfPass[g][s] < 0)
+	{
+		games.turnOfPass[g][s] = t;
+	}
+	if (games.isFinished(g))
+	{
+		for (size_t u = 0; u < NUM_SEATS; u++)
+		{
+			if (games.turnOfPass[g][u] < 0)
+			{
+				games.turnOfPass[g][u] = (u > s) ? t : t + 1;
+			}
+		}
+	}
+}
+
+inline void updateViewBuffers(const GameTable& games, size_t g,
+	size_t activeSeat, TrainingBrain* const* brains)
+{
+	const GameState& state = games.state[g];
+	TrainingBrain* brain = brains[games.slotOfSeat[g][activeSeat]];
+	Personality personality = games.personality(g, activeSeat);
+	size_t offset = games.relativeGameOffset[g][activeSeat];
+	size_t batch = games.batchOf(g, activeSeat);
+	float* rawbuffer = brain->viewBufferPerSeat[batch];
+	float* buffer = &rawbuffer[offset * NUM_VIEW_SETS * NUM_CARDS];
+	brain->tableCardsPerSeat[batch][offset] = state.table();
+	brain->handCardsPerSeat[batch][offset] = state.hand(activeSeat);
+	for (size_t c = 0; c < NUM_CARDS; c++)
+	{
+		buffer[c] = float((state.table() >> c) & 1);
+	}
+	for (size_t t = 0; t < NUM_SEATS; t++)
+	{
+		Personality otherPersonality = games.personality(g, t);
+		int tt = ((t + NUM_SEATS - activeSeat) % NUM_SEATS);
+		uint64_t vision = state.vision(t);
+		uint64_t hand = state.hand(t);
+		if (!(t == activeSeat
+			|| personality == Personality::SPY
+			|| (personality == Personality::GOON
+				&& otherPersonality == Personality::BOSS)))
+		{
+			hand &= vision;
+		}
+		for (size_t c = 0; c < NUM_CARDS; c++)
+		{
+			buffer[(1 + NUM_SEATS + tt) * NUM_CARDS + c] =
+				float((vision >> c) & 1);
+			buffer[(1 + tt) * NUM_CARDS + c] = float((hand >> c) & 1);
+		}
+		size_t offset = (1 + NUM_SEATS + NUM_SEATS) * NUM_CARDS;
+		buffer[offset + tt] = (otherPersonality == Personality::EMPTY);
+		offset += NUM_SEATS;
+		buffer[offset + tt] = games.hasPassed(g, t);
+		offset += NUM_SEATS;
+		buffer[offset + tt] = (otherPersonality == Personality::PLAYER
+				|| otherPersonality == Personality::GREEDY
+				|| otherPersonality == Personality::DUMMY);
+		offset += NUM_SEATS;
+		buffer[offset + tt] = (otherPersonality == Personality::BOSS);
+	}
+	// The rows are reused between rounds, so clear the unused end of the row.
+	std::fill(buffer + (1 + NUM_SEATS + NUM_SEATS) * NUM_CARDS + 4 * NUM_SEATS,
+		buffer + NUM_VIEW_SETS * NUM_CARDS, 0.0f);
+}
+
+inline float determineHandValue(const GameTable& games, size_t g,
+	size_t s, uint64_t cards)
+{
+	HandRule rule = HandRule::NORMAL;
+	if (games.personality(g, s) == Personality::ILLUSIONIST
+		&& !games.hasSwapped(g, s))
+	{
+		rule = HandRule::ILLUSIONIST;
+	}
+	else if (games.personality(g, s) == Personality::FOOL)
+	{
+		// The Fool is trained to only receive points for sets,
+		// so that when playing in the real game it will only try
+		// to collect sets and foolishly discard aces and trumps.
+		rule = HandRule::FOOL;
+	}
+	return handValue(rule, cards);
+}
+
+inline void tallyGameResult(const GameTable& games, size_t g,
+	TrainingTally* tallies)
+{
+	const GameState& state = games.state[g];
+	std::array<float, NUM_SEATS> handValues = { 0 };
+	for (size_t s = 0; s < NUM_SEATS; s++)
+	{
+		handValues[s] = determineHandValue(games, g, s, state.hand(s));
+	}
+	float leastHandValue = 100;
+	for (size_t s = 0; s < NUM_SEATS; s++)
+	{
+		if (handValues[s] < leastHandValue
+			&& games.personality(g, s) != Personality::EMPTY)
+		{
+			leastHandValue = handValues[s];
+		}
+	}
+	for (size_t s = 0; s < NUM_SEATS; s++)
+	{
+		Personality personality = games.personality(g, s);
+		TrainingTally& tally = tallies[games.slotOfSeat[g][s]];
+		if (handValues[s] == leastHandValue)
+		{
+			tally.numLosses += 1;
+			tally.totalLosingHandValue += handValues[s];
+			if (personality == Personality::BOSS)
+			{
+				for (size_t t = 0; t < NUM_SEATS; t++)
+				{
+					tallies[games.slotOfSeat[g][t]].numBossLosses += 1;
+				}
+			}
+			else if (personality == Personality::PLAYER
+				|| personality == Personality::GREEDY
+				|| personality == Personality::DUMMY)
+			{
+				for (size_t t = 0; t < NUM_SEATS; t++)
+				{
+					tallies[games.slotOfSeat[g][t]].numPlayerLosses += 1;
+				}
+			}
+		}
+		else
+		{
+			tally.totalSurvivingHandValue += handValues[s];
+		}
+		tally.totalHandValue += handValues[s];
+		tally.totalTurnsPlayed += games.turnOfPass[g][s] + 1;
+
+		for (size_t suit = 0; suit < NUM_SUITS; suit++)
+		{
+			tally.totalSuitCount[suit] +=
+				countCards(state.hand(s) & suitCards(suit));
+		}
+	}
+}
+
+// Drops the finished games from the active games, and rebuilds the batch of
+// every brain so that it only has rows for the seats that have yet to pass.
+// Later turns then cost in proportion to the games that are still live.
+// Staggered brains have one batch for all of their seats, so then only the
+// seat whose turn it is in the given step gets a row, and games that have
+// yet to start or have played all of their turns get none.
+inline void compactActiveGames(GameTable& games,
+	std::vector<uint32_t>& activeGames, TrainingBrain* const* brains,
+	bool staggered, size_t step, size_t numTurnsPerGame)
+{
+	TRACE_SCOPE("compactActiveGames");
+	for (size_t slot = 0; slot < NUM_BRAIN_SLOTS; slot++)
+	{
+		brains[slot]->numGamesPerSeat.fill(0);
+	}
+	size_t numActive = 0;
+	for (size_t k = 0; k < activeGames.size(); k++)
+	{
+		size_t g = activeGames[k];
+		if (games.isFinished(g))
+		{
+			continue;
+		}
+		activeGames[numActive++] = g;
+		bool isPlaying = !staggered || (step >= games.phase[g]
+			&& step - games.phase[g] < numTurnsPerGame);
+		for (size_t s = 0; s < NUM_SEATS && isPlaying; s++)
+		{
+			if (staggered && (step - games.phase[g]) % NUM_SEATS != s)
+			{
+				continue;
+			}
+			if (!games.hasPassed(g, s))
+			{
+				TrainingBrain* brain = brains[games.slotOfSeat[g][s]];
+				size_t batch = games.batchOf(g, s);
+				games.relativeGameOffset[g][s] = brain->numGamesPerSeat[batch];
+				brain->numGamesPerSeat[batch] += 1;
+			}
+		}
+	}
+	activeGames.resize(numActive);
+}
@@ -15,7 +15,9 @@ inline void save_state_dict(const torch::nn::Module& module,
 	auto buffers = module.named_buffers(true /*recurse*/);
 	for (const auto& val : params)
 	{
-		archive.write(val.key(), val.value());
+		// The parameter may be a view into a larger tensor, such as a row of
+		// a ParameterArena, which would otherwise be saved in its entirety.
+		archive.write(val.key(), val.value().clone());
 	}
 	for (const auto& val : buffers)
 	{
@@ -0,0 +1,119 @@
+#include "trace.hpp"
+
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+
+std::atomic<bool> _tracing(false);
+
+struct TraceEvent
+{
+	const char* name;
+	int64_t start;
+	int64_t end;
+	int64_t id;
+};
+
+// Each thread records into its own buffer, so recording takes no locks.
+struct ThreadTrace
+{
+	std::string name;
+	size_t lane = 0;
+	std::vector<TraceEvent> events;
+};
+
+static std::mutex _traceThreadsMutex;
+static std::vector<std::shared_ptr<ThreadTrace>> _traceThreads;
+static std::chrono::steady_clock::time_point _traceEpoch;
+
+static ThreadTrace& threadTrace()
+{
+	thread_local std::shared_ptr<ThreadTrace> trace = []() {
+		auto trace = std::make_shared<ThreadTrace>();
+		std::lock_guard<std::mutex> lock(_traceThreadsMutex);
+		trace->lane = _traceThreads.size();
+		trace->name = "thread " + std::to_string(trace->lane);
+		_traceThreads.push_back(trace);
+		return trace;
+	}();
+	return *trace;
+}
+
+int64_t traceNow()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now() - _traceEpoch).count();
+}
+
+void recordSpan(const char* name, int64_t start, int64_t id)
+{
+	if (!isTracing())
+	{
+		return;
+	}
+	threadTrace().events.push_back({ name, start, traceNow(), id });
+}
+
+void setTraceThreadName(const std::string& name)
+{
+	ThreadTrace& trace = threadTrace();
+	std::lock_guard<std::mutex> lock(_traceThreadsMutex);
+	trace.name = name;
+}
+
+void startTracing()
+{
+	{
+		std::lock_guard<std::mutex> lock(_traceThreadsMutex);
+		for (auto& trace : _traceThreads)
+		{
+			trace->events.clear();
+		}
+		_traceEpoch = std::chrono::steady_clock::now();
+	}
+	_tracing.store(true);
+}
+
+void stopTracing(const std::string& filepath)
+{
+	_tracing.store(false);
+
+	std::ofstream file(filepath);
+	if (!file)
+	{
+		std::cerr << "Failed to open " << filepath << std::endl;
+		return;
+	}
+	std::lock_guard<std::mutex> lock(_traceThreadsMutex);
+	file << std::fixed << std::setprecision(3);
+	file << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [" << std::endl;
+	bool first = true;
+	for (const auto& trace : _traceThreads)
+	{
+		file << (first ? "" : ",\n") << ""
+			"{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1"
+			", \"tid\": " << trace->lane << ""
+			", \"args\": {\"name\": \"" << trace->name << "\"}}";
+		first = false;
+		for (const TraceEvent& event : trace->events)
+		{
+			// Chrome traces are in microseconds.
+			file << ",\n{\"name\": \"" << event.name << "\", \"ph\": \"X\""
+				", \"pid\": 1, \"tid\": " << trace->lane << ""
+				", \"ts\": " << (0.001 * event.start) << ""
+				", \"dur\": " << (0.001 * (event.end - event.start));
+			if (event.id >= 0)
+			{
+				file << ", \"args\": {\"id\": " << event.id << "}";
+			}
+			file << "}";
+		}
+		trace->events.clear();
+	}
+	file << std::endl << "]}" << std::endl;
+}
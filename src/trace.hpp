@@ -0,0 +1,59 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+
+// Scoped spans that can be written out as a Chrome trace, to be opened in
+// chrome://tracing or Perfetto. While no trace is being recorded, a span
+// costs a single relaxed load, so they can stay in production builds.
+
+extern std::atomic<bool> _tracing;
+
+inline bool isTracing()
+{
+	return _tracing.load(std::memory_order_relaxed);
+}
+
+// Starts recording spans on all threads, forgetting earlier ones.
+void startTracing();
+// Stops recording and writes everything recorded since startTracing().
+// No spans may be open on other threads while this is called.
+void stopTracing(const std::string& filepath);
+// Names the lane of the calling thread in the trace.
+void setTraceThreadName(const std::string& name);
+
+int64_t traceNow();
+void recordSpan(const char* name, int64_t start, int64_t id);
+
+class TraceSpan
+{
+private:
+	const char* _name;
+	int64_t _start;
+	int64_t _id;
+
+public:
+	// The name must be a string literal, because only the pointer is kept.
+	// The id is shown with the span, if it is not negative.
+	explicit TraceSpan(const char* name, int64_t id = -1) :
+		_name(name),
+		_start(isTracing() ? traceNow() : -1),
+		_id(id)
+	{}
+	TraceSpan(const TraceSpan&) = delete;
+	TraceSpan& operator=(const TraceSpan&) = delete;
+
+	~TraceSpan()
+	{
+		if (_start >= 0)
+		{
+			recordSpan(_name, _start, _id);
+		}
+	}
+};
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+#define TRACE_SCOPE(...) TraceSpan TRACE_CONCAT(traceSpan, __LINE__)(__VA_ARGS__)
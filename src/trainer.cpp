@@ -1,7 +1,10 @@
 #include "trainer.hpp"
 
 #include <algorithm>
+#include <cstdio>
 #include <random>
+#include <sstream>
+#include <thread>
 
 #ifdef _MSC_VER
 #include <direct.h>
@@ -11,576 +14,81 @@
 
 #include <torch/torch.h>
 
+#include "checkpointwriter.hpp"
 #include "const.hpp"
+#include "gamestate.hpp"
+#include "gametable.hpp"
+#include "genome.hpp"
+#include "dynamicbatcher.hpp"
+#include "parameterarena.hpp"
+#include "objectstore.hpp"
+#include "personalitybatch.hpp"
+#include "populationfile.hpp"
+#include "simulation.hpp"
+#include "trace.hpp"
 #include "trainingbrain.hpp"
+#include "workerpool.hpp"
 
 
 constexpr size_t ROUNDS_BETWEEN_SAVES = 100;
 
-struct Player
-{
-	std::shared_ptr<TrainingBrain> brain;
-	size_t relativeGameOffset;
-	bool hasPassed = false;
-	bool hasSwapped = false;
-	int turnOfPass = -1;
-};
-
-struct Game
-{
-	std::array<Player, NUM_SEATS> players;
-
-	size_t numPassed() const
-	{
-		size_t count = 0;
-		for (size_t s = 0; s < NUM_SEATS; s++)
-		{
-			if (players[s].hasPassed)
-			{
-				count += 1;
-			}
-		}
-		return count;
-	}
-};
-
-Trainer::Trainer() :
+Trainer::Trainer(const Settings& settings) :
+	_settings(settings),
 	_startTime(std::time(nullptr)),
-	_round(0)
-{
-	torch::set_num_threads(4);
-}
-
-inline float determineHandValue(const Game& game,
-	const uint8_t* state, size_t s);
-
-inline void debugPrintCard(size_t card)
-{
-	if (card >= NUM_SUITS * NUM_FACES_PER_SUIT)
-	{
-		switch (card - NUM_SUITS * NUM_FACES_PER_SUIT)
-		{
-			case 0: std::cout << "CAf"; return; break;
-			case 1: std::cout << "JKR"; return; break;
-			case 2: std::cout << "H12"; return; break;
-			case 3: std::cout << "SAf"; return; break;
-		}
-	}
-	const char* SUITS[NUM_SUITS] = {"C", "D", "H", "S"};
-	const char* FACES[NUM_FACES_PER_SUIT] = {"7", "8", "9", "10",
-		"J", "Q", "K", "A"};
-	std::cout << SUITS[card % NUM_SUITS] << FACES[card / NUM_SUITS];
-}
-
-inline void debugPrintGameState(const Game& game,
-	const uint8_t* state, bool full = false)
-{
-	std::cout << "----------------------" << std::endl;
-	std::cout << "Table: ";
-	for (size_t c = 0; c < NUM_CARDS; c++)
-	{
-		if (state[c] > 0)
-		{
-			debugPrintCard(c);
-			std::cout << " ";
-		}
-	}
-	std::cout << std::endl;
-	for (size_t s = 0; s < NUM_SEATS; s++)
-	{
-		if (game.players[s].brain->personality == Personality::EMPTY)
-		{
-			continue;
-		}
-		std::cout << "Seat " << s << ""
-			" (" << TrainingBrain::personalityName(
-				game.players[s].brain->personality) << ")"
-			": ";
-		for (size_t c = 0; c < NUM_CARDS; c++)
-		{
-			if (state[(1 + s) * NUM_CARDS + c] > 0)
-			{
-				debugPrintCard(c);
-				if (state[(1 + NUM_SEATS + s) * NUM_CARDS + c] > 0)
-				{
-					std::cout << "*";
-				}
-				std::cout << " ";
-			}
-		}
-		if (game.players[s].hasPassed)
-		{
-			std::cout << " <passed>";
-		}
-		std::cout << "   " << determineHandValue(game, state, s);
-		std::cout << "   discarded: ";
-		for (size_t c = 0; c < NUM_CARDS; c++)
-		{
-			if (state[(1 + s) * NUM_CARDS + c] < 1
-				&& state[(1 + NUM_SEATS + s) * NUM_CARDS + c] > 0)
-			{
-				debugPrintCard(c);
-				std::cout << " ";
-			}
-		}
-		std::cout << std::endl;
-	}
-	if (full)
-	{
-		for (size_t i = 0; i < NUM_STATE_SETS * NUM_CARDS; i++)
-		{
-			if (i > 0 && i % NUM_CARDS == 0)
-			{
-				std::cout << std::endl;
-			}
-			else if (i > 0 && (i % NUM_CARDS) % NUM_SUITS == 0)
-			{
-				std::cout << "  ";
-			}
-			std::cout << int(state[i]) << " ";
-		}
-		std::cout << std::endl;
-	}
-	std::cout << "----------------------" << std::endl;
-}
-
-inline void assertCorrectGameState(const Game& game,
-	const uint8_t* state)
+	_round(0),
+	_workers(std::make_unique<WorkerPool>(
+		std::max(1u, std::thread::hardware_concurrency())))
 {
-	size_t numUsed = 0;
-	for (size_t c = 0; c < NUM_CARDS; c++)
-	{
-		bool isUsed = false;
-		for (size_t hand = 0; hand < NUM_SEATS + 1; hand++)
-		{
-			if (state[hand * NUM_CARDS + c] > 0)
-			{
-				if (isUsed)
-				{
-					debugPrintGameState(game, state, /*full=*/true);
-					std::cerr << "card " << c << " used twice" << std::endl;
-					throw std::runtime_error("assertion failed");
-				}
-				isUsed = true;
-				numUsed += 1;
-			}
-		}
-	}
-	if (numUsed != NUM_CARDS_PER_HAND * (NUM_SEATS + 1))
-	{
-		debugPrintGameState(game, state, /*full=*/true);
-		std::cerr << "cards missing" << std::endl;
-		throw std::runtime_error("assertion failed");
-	}
-}
-
-inline void fakeMove(uint8_t* state, size_t activeSeat, uint8_t a, uint8_t b)
-{
-	// Make it so a is the tableCard and b is the ownCard.
-	if (state[b] > 0)
-	{
-		std::swap(a, b);
-	}
-	// Swap the cards.
-	state[a] = 0;
-	state[b] = 1;
-	state[(1 + activeSeat) * NUM_CARDS + a] = 1;
-	state[(1 + activeSeat) * NUM_CARDS + b] = 0;
-	// But do not update vision because that is irreversible.
-}
-
-inline void updateGameState(Game& game,
-	uint8_t* state, size_t activeSeat)
-{
-	if (game.players[activeSeat].hasPassed)
-	{
-		return;
-	}
-
-	auto& brain = game.players[activeSeat].brain;
-	size_t offset = game.players[activeSeat].relativeGameOffset;
-	auto& outputTensor = brain->outputTensorPerSeat[activeSeat][offset];
-	torch::Tensor outputTensorCPU = outputTensor.to(torch::kCPU,
-		torch::kFloat);
-	const float* output = outputTensorCPU.data_ptr<float>();
-	float passWeight = output[2 * NUM_CARDS];
-	bool swapOnPass = false;
-	if (output[2 * NUM_CARDS + 1] > passWeight)
-	{
-		swapOnPass = true;
-		passWeight = output[2 * NUM_CARDS + 1];
-	}
-	size_t tableCard = 0;
-	float tableCardWeight = passWeight - 1;
-	size_t ownCard = 0;
-	float ownCardWeight = passWeight - 1;
-	for (size_t c = 0; c < NUM_CARDS; c++)
-	{
-		if (state[c] > 0
-			&& output[c] > tableCardWeight)
-		{
-			tableCard = c;
-			tableCardWeight = output[c];
-		}
-
-		if (state[(1 + activeSeat) * NUM_CARDS + c] > 0
-			&& output[NUM_CARDS + c] > ownCardWeight)
-		{
-			ownCard = c;
-			ownCardWeight = output[NUM_CARDS + c];
-		}
-	}
-
-	if (brain->personality == Personality::GREEDY)
-	{
-		passWeight = determineHandValue(game, state, activeSeat);
-		tableCardWeight = 0;
-		std::vector<uint8_t> tableCards;
-		std::vector<uint8_t> ownCards;
-		for (uint8_t c = 0; c < NUM_CARDS; c++)
-		{
-			if (state[c] > 0)
-			{
-				tableCards.push_back(c);
-				for (uint8_t x : ownCards)
-				{
-					fakeMove(state, activeSeat, c, x);
-					float value = determineHandValue(game, state, activeSeat);
-					fakeMove(state, activeSeat, c, x);
-					if (value > tableCardWeight)
-					{
-						tableCard = c;
-						ownCard = x;
-						tableCardWeight = value;
-					}
-				}
-			}
-			else if (state[(1 + activeSeat) * NUM_CARDS + c] > 0)
-			{
-				ownCards.push_back(c);
-				for (uint8_t x : tableCards)
-				{
-					fakeMove(state, activeSeat, c, x);
-					float value = determineHandValue(game, state, activeSeat);
-					fakeMove(state, activeSeat, c, x);
-					if (value > passWeight)
-					{
-						ownCard = c;
-						tableCard = x;
-						tableCardWeight = value;
-					}
-				}
-			}
-		}
-		{
-			for (size_t i = 0; i < ownCards.size(); i++)
-			{
-				fakeMove(state, activeSeat, ownCards[i], tableCards[i]);
-			}
-			float value = determineHandValue(game, state, activeSeat);
-			if (value >= 25 && value > passWeight && value > tableCardWeight)
-			{
-				swapOnPass = true;
-				passWeight = value;
-			}
-			for (size_t i = 0; i < ownCards.size(); i++)
-			{
-				fakeMove(state, activeSeat, ownCards[i], tableCards[i]);
-			}
-		}
-		// If we can make a move without losing much value, keep playing.
-		if (passWeight < 14 || tableCardWeight + 1 > passWeight)
-		{
-			passWeight = -1;
-		}
-		ownCardWeight = tableCardWeight;
-	}
-
-	if (tableCardWeight > passWeight && ownCardWeight > passWeight)
+	for (size_t p = 0; p < NUM_PERSONALITIES; p++)
 	{
-		game.players[activeSeat].brain->totalConfidence +=
-			std::max(0.0f,
-				std::min(std::min(tableCardWeight, ownCardWeight), 1.0f));
-
-		// Normal move.
-		state[tableCard] = 0;
-		state[ownCard] = 1;
-		state[(1 + activeSeat) * NUM_CARDS + tableCard] = 1;
-		state[(1 + activeSeat) * NUM_CARDS + ownCard] = 0;
-		state[(1 + NUM_SEATS + activeSeat) * NUM_CARDS + tableCard] = 1;
-		state[(1 + NUM_SEATS + activeSeat) * NUM_CARDS + ownCard] = 1;
-
-		// If all players but one have passed, the game ends after
-		// that player's next turn.
-		if (game.numPassed() == NUM_SEATS - 1)
-		{
-			game.players[activeSeat].hasPassed = true;
-		}
+		_batchPerPersonality.push_back(std::make_unique<PersonalityBatch>());
 	}
-	else
+	_arenaPerPersonality.resize(NUM_PERSONALITIES);
+	torch::set_num_threads(4);
+	if (_settings.fixedSeed)
 	{
-		game.players[activeSeat].brain->totalConfidence +=
-			std::max(0.0f, std::min(passWeight, 1.0f));
-
-		if (swapOnPass)
-		{
-			// Swap with the table.
-			for (size_t c = 0; c < NUM_CARDS; c++)
-			{
-				if (state[c] > 0)
-				{
-					state[c] = 0;
-					state[(1 + activeSeat) * NUM_CARDS + c] = 1;
-					state[(1 + NUM_SEATS + activeSeat) * NUM_CARDS + c] = 1;
-				}
-				else if (state[(1 + activeSeat) * NUM_CARDS + c] > 0)
-				{
-					state[c] = 1;
-					state[(1 + activeSeat) * NUM_CARDS + c] = 0;
-					state[(1 + NUM_SEATS + activeSeat) * NUM_CARDS + c] = 1;
-				}
-			}
-		}
-
-		game.players[activeSeat].hasPassed = true;
-		game.players[activeSeat].hasSwapped = swapOnPass;
+		torch::manual_seed(_settings.seed);
 	}
-
-	// If a player makes 31, the game ends immediately.
-	if (determineHandValue(game, state, activeSeat) >= 31.0f)
+	if (_settings.genomes && ENABLE_CUDA)
 	{
-		for (size_t s = 0; s < NUM_SEATS; s++)
-		{
-			game.players[s].hasPassed = true;
-		}
+		std::cerr << "Genomes need the CPU, saving weights instead"
+			"" << std::endl;
 	}
 }
 
-inline void updateViewBuffers(const Game& game,
-	const uint8_t* state, size_t activeSeat)
+inline bool genomesEnabled(const Settings& settings)
 {
-	auto& brain = game.players[activeSeat].brain;
-	size_t offset = game.players[activeSeat].relativeGameOffset;
-	float* rawbuffer = brain->viewBufferPerSeat[activeSeat].data();
-	float* buffer = &rawbuffer[offset * NUM_VIEW_SETS * NUM_CARDS];
-	for (size_t c = 0; c < NUM_CARDS; c++)
-	{
-		buffer[c] = state[c];
-	}
-	for (size_t t = 0; t < NUM_SEATS; t++)
-	{
-		Personality otherPersonality = game.players[t].brain->personality;
-		int tt = ((t + NUM_SEATS - activeSeat) % NUM_SEATS);
-		for (size_t c = 0; c < NUM_CARDS; c++)
-		{
-			buffer[(1 + NUM_SEATS + tt) * NUM_CARDS + c] =
-				state[(1 + NUM_SEATS + t) * NUM_CARDS + c];
-			if (t == activeSeat
-				|| brain->personality == Personality::SPY
-				|| (brain->personality == Personality::GOON
-					&& otherPersonality == Personality::BOSS))
-			{
-				buffer[(1 + tt) * NUM_CARDS + c] =
-					state[(1 + t) * NUM_CARDS + c];
-			}
-			else
-			{
-				buffer[(1 + tt) * NUM_CARDS + c] =
-					state[(1 + t) * NUM_CARDS + c]
-						* state[(1 + NUM_SEATS + t) * NUM_CARDS + c];
-			}
-		}
-		size_t offset = (1 + NUM_SEATS + NUM_SEATS) * NUM_CARDS;
-		buffer[offset + tt] = (otherPersonality == Personality::EMPTY);
-		offset += NUM_SEATS;
-		buffer[offset + tt] = game.players[t].hasPassed;
-		offset += NUM_SEATS;
-		buffer[offset + tt] = (otherPersonality == Personality::PLAYER
-				|| otherPersonality == Personality::GREEDY
-				|| otherPersonality == Personality::DUMMY);
-		offset += NUM_SEATS;
-		buffer[offset + tt] = (otherPersonality == Personality::BOSS);
-	}
+	return settings.genomes && !ENABLE_CUDA;
 }
 
-inline float determineHandValue(const Game& game,
-	const uint8_t* state, size_t s)
+inline double millisecondsSince(
+	std::chrono::high_resolution_clock::time_point& start)
 {
-	std::array<uint8_t, NUM_CARDS_PER_HAND> hand;
-	{
-		size_t h = 0;
-		for (size_t c = 0; c < NUM_CARDS; c++)
-		{
-			if (state[(1 + s) * NUM_CARDS + c] > 0)
-			{
-				hand[h++] = c;
-			}
-		}
-	}
-	bool hasMatch = true;
-	uint8_t matchingFace = 0;
-	std::array<float, NUM_SUITS> suitValue = { 0 };
-	for (size_t h = 0; h < NUM_CARDS_PER_HAND; h++)
-	{
-		uint8_t suit = hand[h] % NUM_SUITS;
-		uint8_t face = hand[h] / NUM_SUITS;
-		if (face < NUM_FACES_PER_SUIT)
-		{
-			constexpr int VALUE_PER_FACE[NUM_FACES_PER_SUIT] = {
-				7, 8, 9, 10, 10, 10, 10, 11
-			};
-			suitValue[suit] += VALUE_PER_FACE[face];
-		}
-		else
-		{
-			switch (hand[h] - NUM_SUITS * NUM_FACES_PER_SUIT)
-			{
-				case 0:
-				case 3:
-				{
-					// suit = suit;
-					face = NUM_FACES_PER_SUIT - 1; // ace
-					suitValue[suit] += 11;
-				}
-				break;
-				case 1:
-				{
-					face = 255;
-					// joker has no value
-				}
-				break;
-				case 2:
-				{
-					// suit = suit;
-					face = NUM_FACES_PER_SUIT;
-					suitValue[suit] += 12;
-				}
-				break;
-			}
-		}
-		if (h > 0)
-		{
-			hasMatch = hasMatch && (face == matchingFace);
-		}
-		else
-		{
-			matchingFace = face;
-		}
-	}
-
-	if (game.players[s].brain->personality == Personality::ILLUSIONIST
-		&& !game.players[s].hasSwapped)
-	{
-		// Up to one non-Ace clubs becomes a spade.
-		// Up to one non-Ace diamond becomes a heart.
-		if (suitValue[0] <= 10 && suitValue[3] >= 14)
-		{
-			suitValue[3] += suitValue[0];
-		}
-		else if (suitValue[1] <= 10 && suitValue[2] >= 14)
-		{
-			suitValue[2] += suitValue[1];
-		}
-	}
-
-	float v = 0;
-	for (size_t suit = 0; suit < NUM_SUITS; suit++)
-	{
-		if (v < suitValue[suit])
-		{
-			v = suitValue[suit];
-		}
-	}
-
-	if (hasMatch && matchingFace == NUM_FACES_PER_SUIT - 1)
-	{
-		return 31.0f;
-	}
-	else if (hasMatch && v < 30.5f)
-	{
-		return 30.5f;
-	}
-	else if (game.players[s].brain->personality == Personality::FOOL)
-	{
-		// The Fool is trained to only receive points for sets,
-		// so that when playing in the real game it will only try
-		// to collect sets and foolishly discard aces and trumps.
-		return 0;
-	}
-	else
-	{
-		return v;
-	}
+	auto end = std::chrono::high_resolution_clock::now();
+	double elapsed =
+		std::chrono::duration<double, std::milli>(end - start).count();
+	start = end;
+	return elapsed;
 }
 
-inline void tallyGameResult(const Game& game,
-	const uint8_t* state)
-{
-	std::array<float, NUM_SEATS> handValues = { 0 };
-	for (size_t s = 0; s < NUM_SEATS; s++)
-	{
-		handValues[s] = determineHandValue(game, state, s);
-	}
-	float leastHandValue = 100;
-	for (size_t s = 0; s < NUM_SEATS; s++)
-	{
-		if (handValues[s] < leastHandValue
-			&& game.players[s].brain->personality != Personality::EMPTY)
-		{
-			leastHandValue = handValues[s];
-		}
-	}
-	for (size_t s = 0; s < NUM_SEATS; s++)
-	{
-		auto& brain = game.players[s].brain;
-		if (handValues[s] == leastHandValue)
-		{
-			brain->numLosses += 1;
-			brain->totalLosingHandValue += handValues[s];
-			if (brain->personality == Personality::BOSS)
-			{
-				for (size_t t = 0; t < NUM_SEATS; t++)
-				{
-					game.players[t].brain->numBossLosses += 1;
-				}
-			}
-			else if (brain->personality == Personality::PLAYER
-				|| brain->personality == Personality::GREEDY
-				|| brain->personality == Personality::DUMMY)
-			{
-				for (size_t t = 0; t < NUM_SEATS; t++)
-				{
-					game.players[t].brain->numPlayerLosses += 1;
-				}
-			}
-		}
-		else
-		{
-			brain->totalSurvivingHandValue += handValues[s];
-		}
-		brain->totalHandValue += handValues[s];
-		brain->totalTurnsPlayed += game.players[s].turnOfPass + 1;
-
-		for (size_t c = 0; c < NUM_CARDS; c++)
-		{
-			if (state[(1 + s) * NUM_CARDS + c] > 0)
-			{
-				brain->totalSuitCount[c % NUM_SUITS] += 1;
-			}
-		}
-	}
-}
+Trainer::~Trainer() = default;
 
 void Trainer::playRound()
 {
+	TRACE_SCOPE("Trainer::playRound");
 	auto start = std::chrono::high_resolution_clock::now();
 	std::random_device rd;
-	std::mt19937 rng(rd());
+	std::seed_seq seeds = { _settings.fixedSeed ? _settings.seed : rd(),
+		uint32_t(_round) };
+	std::mt19937 rng(seeds);
 
+	// The games refer to brains by slot rather than by pointer.
+	std::vector<TrainingBrain*> brains(NUM_BRAIN_SLOTS);
 	for (size_t p = 0; p < NUM_PERSONALITIES; p++)
 	{
 		for (size_t i = 0; i < NUM_BRAINS_PER_PERSONALITY; i++)
 		{
+			brains[brainSlot(p, i)] = _brainsPerPersonality[p][i].get();
 			for (size_t s = 0; s < NUM_SEATS; s++)
 			{
 				_brainsPerPersonality[p][i]->numGamesPerSeat[s] = 0;
@@ -594,15 +102,22 @@ void Trainer::playRound()
 		normies[p] = p;
 	}
 
-	std::vector<Game> games;
-	size_t numGamesPerBrain = 1000;
+	// Correlation is tracked per seat and per turn, so those rounds are
+	// neither staggered nor dynamically batched.
+	bool dynamic = _settings.dynamicBatching && !ENABLE_CUDA
+		&& _round % ROUNDS_BETWEEN_SAVES != 0;
+	bool staggered = _settings.staggeredSeats && !dynamic
+		&& _round % ROUNDS_BETWEEN_SAVES != 0;
+
+	GameTable games;
+	size_t numGamesPerBrain = _settings.numGamesPerBrain;
 	size_t numNormalGames = NUM_BRAINS_PER_PERSONALITY * numGamesPerBrain
 		* normies.size() / NUM_SEATS;
 	size_t numGoonGames = numGamesPerBrain;
 	games.resize(numNormalGames + numGoonGames);
 
 	size_t remGoonGames = numGoonGames;
-	for (Game& game : games)
+	for (size_t g = 0; g < games.size(); g++)
 	{
 		// Each game includes a stand in for the player.
 		if ((rng() % 3) > 0)
@@ -612,14 +127,14 @@ void Trainer::playRound()
 				? Personality::GREEDY
 				: Personality::DUMMY);
 			size_t i = rng() % NUM_BRAINS_PER_PERSONALITY;
-			game.players[0].brain = _brainsPerPersonality[p][i];
+			games.slotOfSeat[g][0] = brainSlot(p, i);
 		}
 		else
 		{
 			// 33% chance of player
 			size_t p = (size_t) Personality::PLAYER;
 			size_t i = rng() % NUM_BRAINS_PER_PERSONALITY;
-			game.players[0].brain = _brainsPerPersonality[p][i];
+			games.slotOfSeat[g][0] = brainSlot(p, i);
 		}
 
 		// The other players are the actual AIs we are training.
@@ -628,12 +143,12 @@ void Trainer::playRound()
 			remGoonGames--;
 			size_t p = (size_t) Personality::BOSS;
 			size_t i = rng() % NUM_BRAINS_PER_PERSONALITY;
-			game.players[1].brain = _brainsPerPersonality[p][i];
+			games.slotOfSeat[g][1] = brainSlot(p, i);
 			for (size_t s = 2; s < NUM_SEATS; s++)
 			{
 				p = (size_t) Personality::GOON;
 				i = rng() % NUM_BRAINS_PER_PERSONALITY;
-				game.players[s].brain = _brainsPerPersonality[p][i];
+				games.slotOfSeat[g][s] = brainSlot(p, i);
 			}
 		}
 		else
@@ -643,27 +158,37 @@ void Trainer::playRound()
 			{
 				size_t p = normies[s];
 				size_t i = rng() % NUM_BRAINS_PER_PERSONALITY;
-				game.players[s].brain = _brainsPerPersonality[p][i];
+				games.slotOfSeat[g][s] = brainSlot(p, i);
 			}
 		}
 
-		std::shuffle(game.players.begin(), game.players.end(), rng);
+		std::shuffle(games.slotOfSeat[g].begin(), games.slotOfSeat[g].end(), rng);
+		if (staggered)
+		{
+			// Start in a random step, and swap in brains of the class
+			// whose steps are the ones in which their seat is active.
+			games.phase[g] = rng() % NUM_SEATS;
+			for (size_t s = 0; s < NUM_SEATS; s++)
+			{
+				games.batch[g][s] = 0;
+				size_t p = size_t(games.personality(g, s));
+				size_t c = (games.phase[g] + s) % NUM_SEATS;
+				size_t numInClass = (NUM_BRAINS_PER_PERSONALITY - c
+					+ NUM_SEATS - 1) / NUM_SEATS;
+				size_t i = c + NUM_SEATS * (rng() % numInClass);
+				games.slotOfSeat[g][s] = brainSlot(p, i);
+			}
+		}
 		for (size_t s = 0; s < NUM_SEATS; s++)
 		{
-			game.players[s].relativeGameOffset =
-				game.players[s].brain->numGamesPerSeat[s];
-			game.players[s].brain->numGamesPerSeat[s] += 1;
+			TrainingBrain* brain = brains[games.slotOfSeat[g][s]];
+			size_t batch = games.batchOf(g, s);
+			games.relativeGameOffset[g][s] = brain->numGamesPerSeat[batch];
+			brain->numGamesPerSeat[batch] += 1;
 		}
 	}
 
-	// Zero-initialize the game state and the views.
-	std::vector<std::array<uint8_t, NUM_STATE_SETS * NUM_CARDS>> gameState;
-	gameState.resize(games.size());
-	for (size_t g = 0; g < games.size(); g++)
-	{
-		std::fill(gameState[g].begin(), gameState[g].end(), 0);
-	}
-
+	// Zero-initialize the views.
 	for (size_t p = 0; p < NUM_PERSONALITIES; p++)
 	{
 		for (size_t i = 0; i < NUM_BRAINS_PER_PERSONALITY; i++)
@@ -690,51 +215,109 @@ void Trainer::playRound()
 				brain->totalSuitCount[suit] = 0;
 			}
 			brain->objectiveScore = 0;
+			brain->numQuantizedSamples = 0;
+			brain->numQuantizedAgreements = 0;
 		}
 	}
 
-	// Deal the cards from a normal deck of playing cards.
-	std::array<uint8_t, NUM_SUITS * NUM_FACES_PER_SUIT> deck;
-	for (size_t c = 0; c < NUM_SUITS * NUM_FACES_PER_SUIT; c++)
+	// Correlation is tracked per brain, so those rounds are not batched.
+	// The fused kernel does not use torch's threads, so with it the brains
+	// evaluate in parallel instead.
+	bool parallelEvaluation = !ENABLE_CUDA
+		&& _settings.inferenceKernel != InferenceKernel::TORCH
+		&& _round % ROUNDS_BETWEEN_SAVES != 0;
+	// Stacked brains all evaluate in the same step, which staggered
+	// brains do not.
+	bool batched = _settings.batchedInference && !parallelEvaluation
+		&& !staggered && !dynamic && _round % ROUNDS_BETWEEN_SAVES != 0;
+	// Only personalities that play this round are stacked; the stacks of
+	// the others are freed, because without an arena stacking copies all
+	// of their weights.
+	std::array<bool, NUM_PERSONALITIES> isStacked = { false };
+	for (size_t p = 0; p < NUM_PERSONALITIES; p++)
 	{
-		deck[c] = c;
+		if (!batched || !TrainingBrain::isNeural(Personality(p)))
+		{
+			_batchPerPersonality[p]->stack({});
+			continue;
+		}
+		for (size_t i = 0; i < NUM_BRAINS_PER_PERSONALITY; i++)
+		{
+			for (size_t numGames : brains[brainSlot(p, i)]->numGamesPerSeat)
+			{
+				isStacked[p] = isStacked[p] || numGames > 0;
+			}
+		}
+		if (isStacked[p])
+		{
+			_batchPerPersonality[p]->stack(std::vector<TrainingBrain*>(
+					brains.begin() + brainSlot(p, 0),
+					brains.begin() + brainSlot(p + 1, 0)),
+				_arenaPerPersonality[p].get());
+		}
+		else
+		{
+			_batchPerPersonality[p]->stack({});
+		}
 	}
-	for (size_t g = 0; g < games.size(); g++)
+
+	// Each thread tallies the results of its games for every brain,
+	// so that the threads never write to the same brain.
+	std::vector<std::vector<TrainingTally>> talliesPerThread(
+		_workers->size(),
+		std::vector<TrainingTally>(NUM_BRAIN_SLOTS));
+
+	// Deal the cards from a normal deck of playing cards.
+	std::vector<uint32_t> seedPerThread(_workers->size());
+	for (uint32_t& seed : seedPerThread)
 	{
-		std::shuffle(deck.begin(), deck.end(), rng);
-		size_t deckoffset = 0;
-		for (size_t hand = 0; hand < NUM_SEATS + 1; hand++)
+		seed = rng();
+	}
+	_workers->run(games.size(), [&](size_t begin, size_t end, size_t thread) {
+		TRACE_SCOPE("deal");
+		std::mt19937 rng(seedPerThread[thread]);
+		std::array<uint8_t, NUM_SUITS * NUM_FACES_PER_SUIT> deck;
+		for (size_t c = 0; c < NUM_SUITS * NUM_FACES_PER_SUIT; c++)
+		{
+			deck[c] = c;
+		}
+		for (size_t g = begin; g < end; g++)
 		{
-			for (int _z = 0; _z < NUM_CARDS_PER_HAND; _z++)
+			std::shuffle(deck.begin(), deck.end(), rng);
+			size_t deckoffset = 0;
+			for (size_t hand = 0; hand < NUM_SEATS + 1; hand++)
 			{
-				uint8_t card = deck[deckoffset++];
-				if (_z == 0 && hand > 0)
+				for (int _z = 0; _z < NUM_CARDS_PER_HAND; _z++)
 				{
-					size_t s = hand - 1;
-					switch (games[g].players[s].brain->personality)
+					uint8_t card = deck[deckoffset++];
+					if (_z == 0 && hand > 0)
 					{
-						case Personality::FORGER:
-						{
-							card = NUM_FACES_PER_SUIT * NUM_SUITS
-								+ ((rng() % 2 == 0) ? 0 : 3);
-						}
-						break;
-						case Personality::ARTIST:
+						size_t s = hand - 1;
+						switch (games.personality(g, s))
 						{
-							card = NUM_FACES_PER_SUIT * NUM_SUITS + 2;
+							case Personality::FORGER:
+							{
+								card = NUM_FACES_PER_SUIT * NUM_SUITS
+									+ ((rng() % 2 == 0) ? 0 : 3);
+							}
+							break;
+							case Personality::ARTIST:
+							{
+								card = NUM_FACES_PER_SUIT * NUM_SUITS + 2;
+							}
+							break;
+							case Personality::TRICKSTER:
+							{
+								card = NUM_FACES_PER_SUIT * NUM_SUITS + 1;
+							}
+							break;
 						}
-						break;
-						case Personality::TRICKSTER:
-						{
-							card = NUM_FACES_PER_SUIT * NUM_SUITS + 1;
-						}
-						break;
 					}
+					games.state[g].sets[hand] |= cardBit(card);
 				}
-				gameState[g][hand * NUM_CARDS + card] = 1;
 			}
 		}
-	}
+	});
 
 	// Timing:
 	{
@@ -743,93 +326,203 @@ void Trainer::playRound()
 			end - start).count();
 		std::cout << "Initializing took " << elapsed << "ms"
 			"" << std::endl;
+		_metrics.dealMs += std::chrono::duration<double, std::milli>(
+			end - start).count();
+		_metrics.numGames += games.size();
 		start = end;
 	}
 
-	std::cout << "Playing " << games.size() << " games..." << std::endl;
+	std::cout << "Playing " << games.size() << " games"
+		" on " << _workers->size() << " threads..." << std::endl;
 	size_t shownGameIndex = rng() % games.size();
 	std::cout << "(Showing game #" << shownGameIndex << ".)" << std::endl;
 	size_t maxTurnsPerPlayer = 5;
 	bool allFinished = false;
-	for (size_t t = 0; t < maxTurnsPerPlayer && !allFinished; t++)
+	std::vector<uint32_t> activeGames(games.size());
+	for (size_t g = 0; g < games.size(); g++)
+	{
+		activeGames[g] = g;
+	}
+	// In every step, each game lets the player in one seat take a turn.
+	// Staggered games start in the step of their phase, so the last ones
+	// finish a few steps later.
+	size_t numTurnsPerGame = maxTurnsPerPlayer * NUM_SEATS;
+	size_t numSteps = numTurnsPerGame + (staggered ? NUM_SEATS - 1 : 0);
+	if (dynamic)
+	{
+		// The games do not wait for each other, so this plays every game
+		// to the end and leaves nothing for the steps below.
+		std::cout << "Playing without turn barriers"
+			" (" << _settings.maxGamesInFlight << " games in flight"
+			", batches of " << _settings.targetBatchSize << ")"
+			"..." << std::endl;
+		auto phaseStart = std::chrono::high_resolution_clock::now();
+		DynamicBatcher batcher(_settings, games, brains.data(),
+			numTurnsPerGame);
+		batcher.play(*_workers, talliesPerThread);
+		_metrics.numForwardCalls += batcher.numForwardCalls();
+		_metrics.numForwardRows += batcher.numForwardRows();
+		_metrics.evaluateMs += millisecondsSince(phaseStart);
+		activeGames.clear();
+		allFinished = true;
+	}
+	if (staggered)
+	{
+		// Only the games that start in the first step take a turn in it.
+		compactActiveGames(games, activeGames, brains.data(), staggered,
+			0, numTurnsPerGame);
+	}
+	for (size_t step = 0; step < numSteps && !allFinished; step++)
 	{
-		for (size_t s = 0; s < NUM_SEATS && !allFinished; s++)
+		TRACE_SCOPE("turn", step);
+		// Which brains take their turn in this step, and with which batch.
+		size_t batch = staggered ? 0 : (step % NUM_SEATS);
+		auto isScheduled = [&](size_t slot) {
+			return !staggered || staggerClassOfSlot(slot) == step % NUM_SEATS;
+		};
+
+		std::cout << "Preparing"
+			" round " << _round << ""
+			" turn " << step << ""
+			"" << (staggered ? " (class " : " (seat ") << ""
+			"" << (step % NUM_SEATS) << ")"
+			"...\t" << std::flush;
+
+		// Verify some of the games.
+		if (!games.isFinished(shownGameIndex))
 		{
-			std::cout << "Preparing"
-				" round " << _round << ""
-				" turn " << (t * NUM_SEATS + s) << ""
-				" (seat " << s << ")"
-				"...\t" << std::flush;
-
-			// Verify some of the games.
-			if (games[shownGameIndex].numPassed() < NUM_SEATS)
-			{
-				std::cout << std::endl;
-				debugPrintGameState(games[shownGameIndex],
-					gameState[shownGameIndex].data());
-			}
-			for (size_t g = 0; g < games.size();
-				g += (1 + (rng() % (games.size() / 100))))
+			std::cout << std::endl;
+			debugPrintGameState(games, shownGameIndex);
+		}
+		for (size_t g = 0; g < games.size();
+			g += (1 + (rng() % std::max<size_t>(1, games.size() / 100))))
+		{
+			assertCorrectGameState(games, g);
+		}
+
+		// Prepare the views for this turn.
+		auto phaseStart = std::chrono::high_resolution_clock::now();
+		_workers->run(activeGames.size(),
+			[&](size_t begin, size_t end, size_t) {
+				TRACE_SCOPE("updateViewBuffers");
+				for (size_t k = begin; k < end; k++)
+				{
+					size_t g = activeGames[k];
+					if (step < games.phase[g]) continue;
+					size_t turn = step - games.phase[g];
+					if (turn >= numTurnsPerGame) continue;
+					size_t s = turn % NUM_SEATS;
+					if (!games.hasPassed(g, s))
+					{
+						updateViewBuffers(games, g, s, brains.data());
+					}
+				}
+			});
+		for (size_t slot = 0; slot < NUM_BRAIN_SLOTS; slot++)
+		{
+			if (isScheduled(slot))
 			{
-				assertCorrectGameState(games[g], gameState[g].data());
+				brains[slot]->cycle(batch);
 			}
+		}
+
+		_metrics.viewMs += millisecondsSince(phaseStart);
 
-			// Prepare the views for this turn.
-			for (size_t g = 0; g < games.size(); g++)
+		std::cout << "Evaluating...\t" << std::flush;
+		// Brains without games in this seat do not run their network, and
+		// a stack runs once for all of its brains.
+		for (size_t p = 0; p < NUM_PERSONALITIES; p++)
+		{
+			if (!TrainingBrain::isNeural(Personality(p)))
 			{
-				updateViewBuffers(games[g], gameState[g].data(), s);
+				continue;
 			}
-			for (size_t p = 0; p < NUM_PERSONALITIES; p++)
+			size_t numCalls = 0;
+			for (size_t i = 0; i < NUM_BRAINS_PER_PERSONALITY; i++)
 			{
-				for (size_t i = 0; i < NUM_BRAINS_PER_PERSONALITY; i++)
+				size_t slot = brainSlot(p, i);
+				size_t numRows = brains[slot]->numGamesPerSeat[batch];
+				if (isScheduled(slot) && numRows > 0)
 				{
-					_brainsPerPersonality[p][i]->cycle(s);
+					_metrics.numForwardRows += numRows;
+					numCalls += 1;
 				}
 			}
+			_metrics.numForwardCalls += batched ? std::min<size_t>(1, numCalls)
+				: numCalls;
+		}
 
-			std::cout << "Evaluating...\t" << std::flush;
-
-			// Let all brains evaluate their positions.
+		// Let all brains evaluate their positions.
+		if (parallelEvaluation)
+		{
+			_workers->run(NUM_BRAIN_SLOTS,
+				[&](size_t begin, size_t end, size_t /*thread*/) {
+					torch::NoGradGuard no_grad;
+					for (size_t slot = begin; slot < end; slot++)
+					{
+						if (isScheduled(slot))
+						{
+							brains[slot]->evaluate(batch, step / NUM_SEATS,
+								_settings);
+						}
+					}
+				});
+		}
+		else
+		{
 			for (size_t p = 0; p < NUM_PERSONALITIES; p++)
 			{
+				if (batched && TrainingBrain::isNeural(Personality(p)))
+				{
+					if (isStacked[p])
+					{
+						_batchPerPersonality[p]->evaluate(batch);
+					}
+					continue;
+				}
 				for (size_t i = 0; i < NUM_BRAINS_PER_PERSONALITY; i++)
 				{
-					_brainsPerPersonality[p][i]->evaluate(s, t);
+					if (isScheduled(brainSlot(p, i)))
+					{
+						_brainsPerPersonality[p][i]->evaluate(batch,
+							step / NUM_SEATS, _settings);
+					}
 				}
 			}
+		}
 
-			std::cout << "Updating...\t" << std::flush;
+		_metrics.evaluateMs += millisecondsSince(phaseStart);
 
-			// Use the results to change the game state.
-			size_t numUnfinished = 0;
-			for (size_t g = 0; g < games.size(); g++)
-			{
-				updateGameState(games[g], gameState[g].data(), s);
-				if (games[g].players[s].hasPassed
-					&& games[g].players[s].turnOfPass < 0)
-				{
-					games[g].players[s].turnOfPass = t;
-				}
-				if (games[g].numPassed() < NUM_SEATS)
+		std::cout << "Updating...\t" << std::flush;
+
+		// Use the results to change the game state.
+		_workers->run(activeGames.size(),
+			[&](size_t begin, size_t end, size_t thread) {
+				TRACE_SCOPE("updateGameState");
+				TrainingTally* tallies = talliesPerThread[thread].data();
+				for (size_t k = begin; k < end; k++)
 				{
-					numUnfinished += 1;
+					size_t g = activeGames[k];
+					if (step < games.phase[g]) continue;
+					size_t turn = step - games.phase[g];
+					if (turn >= numTurnsPerGame) continue;
+					size_t s = turn % NUM_SEATS;
+					size_t t = turn / NUM_SEATS;
+					updateGameState(games, g, s, brains.data(), tallies);
+					updateTurnsOfPass(games, g, s, t);
 				}
-			}
-			allFinished = (numUnfinished == 0);
+			});
 
-			std::cout << "Still " << numUnfinished << " games"
-				" left unfinished." << std::endl;
-		}
-	}
-	for (size_t g = 0; g < games.size(); g ++)
-	{
-		for (size_t s = 0; s < NUM_SEATS; s++)
-		{
-			if (games[g].players[s].turnOfPass < 0)
-			{
-				games[g].players[s].turnOfPass = maxTurnsPerPlayer;
-			}
-		}
+		// Staggered batches are rebuilt for the next step.
+		compactActiveGames(games, activeGames, brains.data(), staggered,
+			step + 1, numTurnsPerGame);
+		_metrics.updateMs += millisecondsSince(phaseStart);
+		size_t numUnfinished = activeGames.size();
+		_metrics.numUnfinishedPerTurn.push_back(numUnfinished);
+		allFinished = (numUnfinished == 0);
+
+		std::cout << "Still " << numUnfinished << " games"
+			" left unfinished." << std::endl;
 	}
 
 	// Timing:
@@ -844,14 +537,48 @@ void Trainer::playRound()
 	}
 
 	// Verify and tally all of the games.
-	for (size_t g = 0; g < games.size(); g ++)
+	debugPrintGameState(games, shownGameIndex);
+	_workers->run(games.size(), [&](size_t begin, size_t end, size_t thread) {
+		TRACE_SCOPE("tallyGameResult");
+		TrainingTally* tallies = talliesPerThread[thread].data();
+		for (size_t g = begin; g < end; g++)
+		{
+			for (size_t s = 0; s < NUM_SEATS; s++)
+			{
+				if (games.turnOfPass[g][s] < 0)
+				{
+					games.turnOfPass[g][s] = maxTurnsPerPlayer;
+				}
+			}
+			assertCorrectGameState(games, g);
+			tallyGameResult(games, g, tallies);
+		}
+	});
+	for (const auto& tallies : talliesPerThread)
 	{
-		if (g == shownGameIndex)
+		for (size_t p = 0; p < NUM_PERSONALITIES; p++)
 		{
-			debugPrintGameState(games[g], gameState[g].data());
+			for (size_t i = 0; i < NUM_BRAINS_PER_PERSONALITY; i++)
+			{
+				_brainsPerPersonality[p][i]->addTally(tallies[brainSlot(p, i)]);
+			}
+		}
+	}
+
+	if (_settings.inferenceKernel == InferenceKernel::QUANTIZED)
+	{
+		int numSamples = 0;
+		int numAgreements = 0;
+		for (const TrainingBrain* brain : brains)
+		{
+			numSamples += brain->numQuantizedSamples;
+			numAgreements += brain->numQuantizedAgreements;
 		}
-		assertCorrectGameState(games[g], gameState[g].data());
-		tallyGameResult(games[g], gameState[g].data());
+		std::cout << "Int8 picked the same action as fp32"
+			" in " << numAgreements << " of " << numSamples << " samples"
+			" (" << (0.1f * int(1000.0f * numAgreements
+				/ std::max(1, numSamples))) << "%)"
+			"" << std::endl;
 	}
 
 	// Timing:
@@ -861,6 +588,8 @@ void Trainer::playRound()
 			end - start).count();
 		std::cout << "Tallying took " << elapsed << "ms"
 			"" << std::endl;
+		_metrics.tallyMs += std::chrono::duration<double, std::milli>(
+			end - start).count();
 		start = end;
 	}
 }
@@ -879,8 +608,19 @@ inline void ensureFolderExists(const std::string& folder)
 	}
 }
 
+inline std::string brainName(const TrainingBrain& brain)
+{
+	std::string name;
+	name += TrainingBrain::personalityName(brain.personality);
+	name += "_" + std::to_string(brain.serialNumber);
+	name += "_" + std::to_string(brain.motherNumber);
+	name += "_" + std::to_string(brain.fatherNumber);
+	return name;
+}
+
 void Trainer::sortBrains()
 {
+	TRACE_SCOPE("Trainer::sortBrains");
 	auto start = std::chrono::high_resolution_clock::now();
 
 	for (size_t p = 0; p < NUM_PERSONALITIES; p++)
@@ -950,7 +690,8 @@ void Trainer::sortBrains()
 			});
 	}
 
-	std::string folder = BRAIN_OUTPUT_FOLDER "/" + std::to_string(_startTime);
+	std::string folder = _settings.outputFolder + "/"
+		+ std::to_string(_startTime);
 	ensureFolderExists(folder);
 
 	std::ofstream progress;
@@ -1038,64 +779,50 @@ void Trainer::sortBrains()
 		{
 			continue;
 		}
-		float pAverageScore = pTotalScore / NUM_BRAINS_PER_PERSONALITY;
-		float pAverageTurnsBeforePass = 1.0 * pTotalTurnsPlayed / pNum;
-		float pAverageConfidence = pTotalConfidence
-			/ std::max(1, pTotalTurnsPlayed);
-		float pAverageWinValue = pTotalWinValue / std::max(1, pSurv);
-		float pAverageLossValue = pTotalLossValue / std::max(1, pNum - pSurv);
-		std::array<float, NUM_SUITS> suitBias = { 0 };
-		float totalSquaredSuitBias = 0;
+		PersonalityMetrics metrics;
+		metrics.name = TrainingBrain::personalityName((Personality) p);
+		metrics.numGames = pNum;
+		metrics.averageScore = pTotalScore / NUM_BRAINS_PER_PERSONALITY;
+		metrics.survivalRate = 1.0f * pSurv / pNum;
+		metrics.averageTurnsBeforePass = 1.0f * pTotalTurnsPlayed / pNum;
+		metrics.averageHandValue = pTotalHandValue / pNum;
+		metrics.averageWinValue = pTotalWinValue / std::max(1, pSurv);
+		metrics.averageLossValue = pTotalLossValue / std::max(1, pNum - pSurv);
 		for (size_t suit = 0; suit < NUM_SUITS; suit++)
 		{
-			suitBias[suit] = pTotalSuitCount[suit] / pNum
+			metrics.suitBias[suit] = pTotalSuitCount[suit] / pNum
 				- (1.0f * NUM_CARDS_PER_HAND / NUM_SUITS);
-			totalSquaredSuitBias += suitBias[suit] * suitBias[suit];
+			metrics.totalSquaredSuitBias +=
+				metrics.suitBias[suit] * metrics.suitBias[suit];
 		}
-		std::cout << "Overall,"
-			" " << TrainingBrain::personalityName((Personality) p) << ""
-			" scored " << (0.1 * int(10 * pAverageScore)) << ""
+		metrics.averageConfidence = pTotalConfidence
+			/ std::max(1, pTotalTurnsPlayed);
+		_metrics.personalities.push_back(metrics);
+
+		std::stringstream summary;
+		summary << ""
+			" scored " << (0.1 * int(10 * metrics.averageScore)) << ""
 			", survived"
-			" " << (0.1 * int(100 * 10 * pSurv / pNum)) << "%"
+			" " << (0.1 * int(100 * 10 * metrics.survivalRate)) << "%"
 			" of games"
 			", played"
-			" " << (0.1 * int(10 * pAverageTurnsBeforePass)) << " turns"
+			" " << (0.1 * int(10 * metrics.averageTurnsBeforePass)) << " turns"
 			" and had average hand value"
-			" " << (0.1 * int(10 * pTotalHandValue / pNum)) << ""
-			" (win: " << (0.1 * int(10 * pAverageWinValue)) << ""
-			", loss: " << (0.1 * int(10 * pAverageLossValue)) << ")"
-			", bias " << (0.1 * int(10 * totalSquaredSuitBias)) << ""
-			" (C: " << (0.1 * int(10 * suitBias[0])) << ""
-			", D: " << (0.1 * int(10 * suitBias[1])) << ""
-			", H: " << (0.1 * int(10 * suitBias[2])) << ""
-			", S: " << (0.1 * int(10 * suitBias[3])) << ""
+			" " << (0.1 * int(10 * metrics.averageHandValue)) << ""
+			" (win: " << (0.1 * int(10 * metrics.averageWinValue)) << ""
+			", loss: " << (0.1 * int(10 * metrics.averageLossValue)) << ")"
+			", bias " << (0.1 * int(10 * metrics.totalSquaredSuitBias)) << ""
+			" (C: " << (0.1 * int(10 * metrics.suitBias[0])) << ""
+			", D: " << (0.1 * int(10 * metrics.suitBias[1])) << ""
+			", H: " << (0.1 * int(10 * metrics.suitBias[2])) << ""
+			", S: " << (0.1 * int(10 * metrics.suitBias[3])) << ""
 			")"
 			" with confidence"
-			" " << (0.1 * int(100 * 10 * pAverageConfidence)) << "%"
-			"" << std::endl;
+			" " << (0.1 * int(100 * 10 * metrics.averageConfidence)) << "%";
+		std::cout << "Overall, " << metrics.name << summary.str() << std::endl;
 		std::cout << std::endl;
 
-		progress << ""
-			"" << TrainingBrain::personalityName((Personality) p) << ""
-			" scored " << (0.1 * int(10 * pAverageScore)) << ""
-			", survived"
-			" " << (0.1 * int(100 * 10 * pSurv / pNum)) << "%"
-			" of games"
-			", played"
-			" " << (0.1 * int(10 * pAverageTurnsBeforePass)) << " turns"
-			" and had average hand value"
-			" " << (0.1 * int(10 * pTotalHandValue / pNum)) << ""
-			" (win: " << (0.1 * int(10 * pAverageWinValue)) << ""
-			", loss: " << (0.1 * int(10 * pAverageLossValue)) << ")"
-			", bias " << (0.1 * int(10 * totalSquaredSuitBias)) << ""
-			" (C: " << (0.1 * int(10 * suitBias[0])) << ""
-			", D: " << (0.1 * int(10 * suitBias[1])) << ""
-			", H: " << (0.1 * int(10 * suitBias[2])) << ""
-			", S: " << (0.1 * int(10 * suitBias[3])) << ""
-			")"
-			" with confidence"
-			" " << (0.1 * int(100 * 10 * pAverageConfidence)) << "%"
-			"" << std::endl;
+		progress << metrics.name << summary.str() << std::endl;
 	}
 
 	// Timing:
@@ -1105,12 +832,15 @@ void Trainer::sortBrains()
 			end - start).count();
 		std::cout << "Sorting brains took " << elapsed << "ms"
 			"" << std::endl;
+		_metrics.sortMs += std::chrono::duration<double, std::milli>(
+			end - start).count();
 		start = end;
 	}
 }
 
 void Trainer::evolveBrains()
 {
+	TRACE_SCOPE("Trainer::evolveBrains");
 	auto start = std::chrono::high_resolution_clock::now();
 
 	for (size_t p = 0; p < NUM_PERSONALITIES; p++)
@@ -1129,22 +859,20 @@ void Trainer::evolveBrains()
 		double deviationFactor = 0.05 / sqrt(_round + 1);
 		for (size_t k = 0; k < chunkSize && i > 2 * chunkSize; k++, i--)
 		{
-			auto brain = pool[k]->makeMutation(deviationFactor);
-			pool[i] = std::make_shared<TrainingBrain>(std::move(brain));
+			pool[i]->becomeMutationOf(*pool[k], deviationFactor, _round);
 		}
 		// A fifth of the new pool will consist of the offspring of
 		// pairs of brains from the best fifth and second fifth.
 		for (size_t k = 0; k < chunkSize && i > 2 * chunkSize; k++, i--)
 		{
-			auto brain = pool[k]->makeOffspringWith(*pool[chunkSize + k]);
-			pool[i] = std::make_shared<TrainingBrain>(std::move(brain));
+			pool[i]->becomeOffspringOf(*pool[k], *pool[chunkSize + k],
+				_round);
 		}
 		// The middle fifth of the new pool is spliced with
 		// brains from the best fifth.
 		for (size_t k = 0; k < chunkSize && i > 2 * chunkSize; k++, i--)
 		{
-			auto brain = pool[i]->makeOffspringWith(*pool[k]);
-			pool[i] = std::make_shared<TrainingBrain>(std::move(brain));
+			pool[i]->becomeOffspringOf(*pool[i], *pool[k], _round);
 		}
 	}
 
@@ -1155,22 +883,35 @@ void Trainer::evolveBrains()
 			end - start).count();
 		std::cout << "Evolving brains took " << elapsed << "ms"
 			"" << std::endl;
+		_metrics.evolveMs += std::chrono::duration<double, std::milli>(
+			end - start).count();
 		start = end;
 	}
 }
 
 void Trainer::saveBrains()
 {
+	TRACE_SCOPE("Trainer::saveBrains");
 	auto start = std::chrono::high_resolution_clock::now();
-	std::random_device rd;
-	std::mt19937 rng(rd());
 
-	std::string folder = BRAIN_OUTPUT_FOLDER "/" + std::to_string(_startTime);
+	std::string folder = _settings.outputFolder + "/"
+		+ std::to_string(_startTime);
 	ensureFolderExists(folder);
 
-	std::ofstream list;
-	list.open(folder + "/round" + std::to_string(_round) + ".txt");
-
+	// Only copy the brains here, and write them while training goes on.
+	Checkpoint checkpoint;
+	checkpoint.folder = folder;
+	checkpoint.round = _round;
+	checkpoint.withPopulationFile = _settings.populationFiles;
+	if (_settings.objectStore)
+	{
+		checkpoint.outputFolder = _settings.outputFolder;
+		ensureFolderExists(_settings.outputFolder + "/objects");
+	}
+	if (genomesEnabled(_settings))
+	{
+		ensureFolderExists(folder + "/genomes");
+	}
 	for (size_t p = 0; p < NUM_PERSONALITIES; p++)
 	{
 		for (size_t i = 0; i < NUM_BRAINS_PER_PERSONALITY; i++)
@@ -1178,28 +919,43 @@ void Trainer::saveBrains()
 			auto& brain = _brainsPerPersonality[p][i];
 			if (brain && brain->numGames > 0)
 			{
-				std::string name;
-				name += TrainingBrain::personalityName(brain->personality);
-				name += "_" + std::to_string(brain->serialNumber);
-				name += "_" + std::to_string(brain->motherNumber);
-				name += "_" + std::to_string(brain->fatherNumber);
-
-				brain->save(folder + "/" + name + ".pth.tar");
-				if (i == 0)
+				// Every genome starts from a checkpoint. The weights of brains
+				// that are saved without a genome, or whose genome has become
+				// too long to replay quickly, are written with this round,
+				// and their offspring start from that file.
+				std::string genomeCheckpoint;
+				if (genomesEnabled(_settings)
+					&& TrainingBrain::isNeural(brain->personality)
+					&& (!brain->genome
+						|| countGenomeSteps(*brain->genome,
+							_settings.maxGenomeSteps + 1)
+						> _settings.maxGenomeSteps))
 				{
-					brain->save(folder + "/" + name + "_cpu.pth.tar",
-						/*forceCPU=*/true);
+					genomeCheckpoint = folder + "/genomes/"
+						"" + brainName(*brain) + ".pth.tar";
+					brain->genome = makeCheckpointGenome(genomeCheckpoint);
 				}
-				brain->saveScan(folder + "/" + name + ".png");
-				brain->saveCorrelationScan(
-					folder + "/" + name + "_correlation.png");
-
-				list << name << " "
-					<< (0.1 * int(10 * brain->objectiveScore))
-					<< std::endl;
+				Checkpoint::Entry entry;
+				entry.genomeCheckpoint = genomeCheckpoint;
+				entry.brain = brain->snapshot();
+				entry.name = brainName(*brain);
+				entry.objectiveScore = brain->objectiveScore;
+				entry.withCPUCopy = (i == 0);
+				// Brains only need to be hashed once, as they do not change.
+				if (_settings.objectStore && !brain->genome
+					&& TrainingBrain::isNeural(brain->personality))
+				{
+					if (brain->contentHash.empty())
+					{
+						brain->contentHash = hashParameters(brain->parameters());
+					}
+					entry.contentHash = brain->contentHash;
+				}
+				checkpoint.entries.push_back(std::move(entry));
 			}
 		}
 	}
+	_checkpointWriter->write(std::move(checkpoint));
 
 	// Timing:
 	{
@@ -1208,25 +964,47 @@ void Trainer::saveBrains()
 			end - start).count();
 		std::cout << "Saving brains took " << elapsed << "ms"
 			"" << std::endl;
+		_metrics.saveMs += std::chrono::duration<double, std::milli>(
+			end - start).count();
 		start = end;
 	}
 }
 
-void Trainer::resume(std::string session, int round)
+// The last save of a round whose brains were evolved and not saved
+// is the save of the next round.
+inline int savedRound(int round)
 {
-	std::string folder = BRAIN_OUTPUT_FOLDER "/" + session;
-	std::string filename = folder + "/round" + std::to_string(round) + ".txt";
 	if (ROUNDS_BETWEEN_SAVES > 1 && ((round + 1) % ROUNDS_BETWEEN_SAVES) == 0)
 	{
-		filename = folder + "/round" + std::to_string(round + 1) + ".txt";
+		return round + 1;
+	}
+	return round;
+}
+
+void Trainer::resume(std::string session, int round)
+{
+	std::string folder = _settings.outputFolder + "/" + session;
+	std::string prefix = folder + "/round" + std::to_string(savedRound(round));
+	{
+		std::string populationFilename = prefix + ".population";
+		struct stat buffer;
+		if (stat(populationFilename.c_str(), &buffer) == 0)
+		{
+			resumePopulation(populationFilename);
+			_round = round + 1;
+			return;
+		}
 	}
 
+	std::string filename = prefix + ".txt";
+
 	std::ifstream file(filename);
 	if (!file)
 	{
 		std::cerr << "Failed to open " << filename << std::endl;
 		throw std::runtime_error("Failed to open " + filename);
 	}
+	ObjectStore store(_settings.outputFolder);
 	std::string line;
 	std::array<size_t, NUM_PERSONALITIES> countPerPersonality = { 0 };
 	while (std::getline(file, line))
@@ -1276,7 +1054,35 @@ void Trainer::resume(std::string session, int round)
 		}
 		_brainsPerPersonality[p][i] =
 			std::make_shared<TrainingBrain>((Personality) p);
-		_brainsPerPersonality[p][i]->load(folder + "/" + name + ".pth.tar");
+		std::string genomePath = folder + "/" + name + ".genome";
+		std::string checkpointPath = folder + "/" + name + ".pth.tar";
+		// Lines that refer to the object store end with the hash.
+		std::string hash;
+		{
+			std::stringstream strm = std::stringstream(line);
+			std::string word;
+			std::string score;
+			strm >> word >> score >> hash;
+			if (!hash.empty() && store.contains(hash))
+			{
+				checkpointPath = store.pathOf(hash);
+				_brainsPerPersonality[p][i]->contentHash = hash;
+			}
+		}
+		struct stat buffer;
+		if (stat(genomePath.c_str(), &buffer) == 0)
+		{
+			_brainsPerPersonality[p][i]->loadGenome(genomePath);
+		}
+		else
+		{
+			_brainsPerPersonality[p][i]->load(checkpointPath);
+			if (genomesEnabled(_settings))
+			{
+				_brainsPerPersonality[p][i]->genome =
+					makeCheckpointGenome(checkpointPath);
+			}
+		}
 		countPerPersonality[p] += 1;
 	}
 	for (size_t p = 0; p < NUM_PERSONALITIES; p++)
@@ -1292,6 +1098,133 @@ void Trainer::resume(std::string session, int round)
 	_round = round + 1;
 }
 
+void Trainer::resumePopulation(const std::string& filepath)
+{
+	auto start = std::chrono::high_resolution_clock::now();
+
+	PopulationFile population(filepath);
+	std::array<std::vector<const BrainRecord*>, NUM_PERSONALITIES>
+		recordsPerPersonality;
+	for (size_t i = 0; i < population.header().numBrains; i++)
+	{
+		const BrainRecord& record = population.brain(i);
+		if (record.personality >= NUM_PERSONALITIES)
+		{
+			std::cerr << "Ignoring unknown personality"
+				" " << record.personality << std::endl;
+			continue;
+		}
+		auto& records = recordsPerPersonality[record.personality];
+		if (records.size() >= NUM_BRAINS_PER_PERSONALITY)
+		{
+			std::cerr << "Ignoring excess for " << TrainingBrain::personalityName(
+				(Personality) record.personality) << std::endl;
+			continue;
+		}
+		records.push_back(&record);
+	}
+
+	for (size_t p = 0; p < NUM_PERSONALITIES; p++)
+	{
+		const auto& records = recordsPerPersonality[p];
+		bool hasWeights = !records.empty() && records[0]->hasWeights;
+		for (size_t i = 0; hasWeights && i < records.size(); i++)
+		{
+			if (!records[i]->hasWeights
+				|| records[i]->row != records[0]->row + i)
+			{
+				std::cerr << "Invalid population file " << filepath << std::endl;
+				throw std::runtime_error("Invalid population file " + filepath);
+			}
+		}
+
+		std::unique_ptr<ParameterArena> arena;
+		if (hasWeights)
+		{
+			arena = std::make_unique<ParameterArena>(
+				population.rows(records[0]->row, records.size()));
+		}
+		if (arena && !ENABLE_CUDA
+			&& records.size() == NUM_BRAINS_PER_PERSONALITY)
+		{
+			// Use the mapped rows as they are; only the pages of brains
+			// that change are copied, and no weights are initialized.
+			for (size_t i = 0; i < records.size(); i++)
+			{
+				_brainsPerPersonality[p][i] =
+					std::make_shared<TrainingBrain>((Personality) p, *arena);
+			}
+			_arenaPerPersonality[p] = std::move(arena);
+		}
+		else
+		{
+			for (size_t i = 0; i < records.size(); i++)
+			{
+				_brainsPerPersonality[p][i] =
+					std::make_shared<TrainingBrain>((Personality) p);
+				if (arena)
+				{
+					_brainsPerPersonality[p][i]->loadFrom(*arena, i);
+				}
+			}
+		}
+		// The records are in order of rank, as they were saved.
+		for (size_t i = 0; i < records.size(); i++)
+		{
+			TrainingBrain& brain = *_brainsPerPersonality[p][i];
+			brain.restoreIdentity(records[i]->serialNumber,
+				records[i]->motherNumber, records[i]->fatherNumber);
+			brain.objectiveScore = records[i]->objectiveScore;
+		}
+	}
+	for (size_t p = 0; p < NUM_PERSONALITIES; p++)
+	{
+		if (recordsPerPersonality[p].size() < NUM_BRAINS_PER_PERSONALITY)
+		{
+			std::cerr << "Adding brains for "
+				<< TrainingBrain::personalityName((Personality) p)
+				<< std::endl;
+		}
+	}
+
+	// Timing:
+	{
+		auto end = std::chrono::high_resolution_clock::now();
+		int elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+			end - start).count();
+		std::cout << "Loading " << filepath << " took " << elapsed << "ms"
+			"" << std::endl;
+	}
+}
+
+void Trainer::writePopulation(std::string session, int round)
+{
+	std::string folder = _settings.outputFolder + "/" + session;
+	std::string filepath = folder + "/round"
+		+ std::to_string(savedRound(round)) + ".population";
+
+	std::vector<const TrainingBrain*> brains;
+	for (size_t p = 0; p < NUM_PERSONALITIES; p++)
+	{
+		for (const auto& brain : _brainsPerPersonality[p])
+		{
+			if (brain)
+			{
+				brains.push_back(brain.get());
+			}
+		}
+	}
+	// The brains may have been resumed from the same file, which is mapped.
+	writePopulationFile(filepath + ".tmp", savedRound(round), brains);
+	std::remove(filepath.c_str());
+	if (std::rename((filepath + ".tmp").c_str(), filepath.c_str()) != 0)
+	{
+		std::cerr << "Failed to rename " << filepath << ".tmp" << std::endl;
+		throw std::runtime_error("Failed to rename " + filepath + ".tmp");
+	}
+	std::cout << "Wrote " << filepath << std::endl;
+}
+
 void Trainer::train()
 {
 	auto start = std::chrono::high_resolution_clock::now();
@@ -1316,6 +1249,27 @@ void Trainer::train()
 		}
 	}
 
+	// Keep the parameters of each personality together. Culled brains are
+	// reused in place, so they stay there. Personalities resumed from a
+	// population file already use its rows.
+	if (!ENABLE_CUDA)
+	{
+		for (size_t p = 0; p < NUM_PERSONALITIES; p++)
+		{
+			if (!TrainingBrain::isNeural((Personality) p)
+				|| _arenaPerPersonality[p])
+			{
+				continue;
+			}
+			_arenaPerPersonality[p] =
+				std::make_unique<ParameterArena>(NUM_BRAINS_PER_PERSONALITY);
+			for (auto& brain : _brainsPerPersonality[p])
+			{
+				brain->moveInto(*_arenaPerPersonality[p]);
+			}
+		}
+	}
+
 	// Timing:
 	{
 		auto end = std::chrono::high_resolution_clock::now();
@@ -1325,23 +1279,60 @@ void Trainer::train()
 			"" << std::endl;
 	}
 
-	size_t numRounds = 10000;
-	for (; _round <= numRounds; _round++)
+	{
+		std::string folder = _settings.outputFolder + "/"
+			+ std::to_string(_startTime);
+		ensureFolderExists(folder);
+		_metricsSink = std::make_unique<MetricsSink>(folder + "/metrics.jsonl");
+		_checkpointWriter = std::make_unique<CheckpointWriter>();
+	}
+	setTraceThreadName("main");
+
+	for (; _round <= _settings.lastRound; _round++)
 	{
 		std::cout << "########################################" << std::endl;
 		std::cout << "ROUND " << _round << std::endl;
 		std::cout << "########################################" << std::endl;
 
+		bool traced = std::find(_settings.tracedRounds.begin(),
+			_settings.tracedRounds.end(), _round) != _settings.tracedRounds.end();
+		if (traced)
+		{
+			startTracing();
+		}
+
+		auto roundStart = std::chrono::high_resolution_clock::now();
+		_metrics = RoundMetrics();
+		_metrics.round = _round;
+
 		playRound();
 		sortBrains();
 		if (_round % ROUNDS_BETWEEN_SAVES == 0)
 		{
 			saveBrains();
+			_metrics.saved = true;
 		}
 		evolveBrains();
 
+		if (traced)
+		{
+			std::string filepath = _settings.outputFolder + "/"
+				+ std::to_string(_startTime) + ""
+				"/trace" + std::to_string(_round) + ".json";
+			stopTracing(filepath);
+			std::cout << "Wrote trace to " << filepath << std::endl;
+		}
+
+		_metrics.totalMs = millisecondsSince(roundStart);
+		_metrics.peakMemoryBytes = peakMemoryBytes();
+		_metricsPerRound.push_back(_metrics);
+		_metricsSink->write(_metrics);
+
 		std::cout << "########################################" << std::endl;
 		std::cout << "ROUND " << _round << std::endl;
 		std::cout << "########################################" << std::endl;
 	}
+
+	// The last checkpoint may still be being written.
+	_checkpointWriter->flush();
 }
@@ -7,26 +7,40 @@
 #include <array>
 
 #include "const.hpp"
+#include "metrics.hpp"
+#include "settings.hpp"
 
 class TrainingBrain;
+class WorkerPool;
+class PersonalityBatch;
+class ParameterArena;
+class CheckpointWriter;
 
 
 class Trainer
 {
 private:
+	const Settings _settings;
 	std::time_t _startTime;
 	std::array<
 		std::array<std::shared_ptr<TrainingBrain>, NUM_BRAINS_PER_PERSONALITY>,
 		NUM_PERSONALITIES> _brainsPerPersonality;
 	size_t _round;
+	std::unique_ptr<WorkerPool> _workers;
+	std::vector<std::unique_ptr<PersonalityBatch>> _batchPerPersonality;
+	std::vector<std::unique_ptr<ParameterArena>> _arenaPerPersonality;
+	RoundMetrics _metrics;
+	std::vector<RoundMetrics> _metricsPerRound;
+	std::unique_ptr<MetricsSink> _metricsSink;
+	std::unique_ptr<CheckpointWriter> _checkpointWriter;
 
 public:
-	Trainer();
+	explicit Trainer(const Settings& settings);
 	Trainer(const Trainer&) = delete;
 	Trainer(Trainer&& other) = delete;
 	Trainer& operator=(const Trainer&) = delete;
 	Trainer& operator=(Trainer&&) = delete;
-	~Trainer() = default;
+	~Trainer();
 
 private:
 	void playRound();
@@ -34,7 +48,16 @@ private:
 	void evolveBrains();
 	void saveBrains();
 
+	void resumePopulation(const std::string& filepath);
+
 public:
 	void resume(std::string session, int round);
+	// Writes the brains of a resumed round as a single population file.
+	void writePopulation(std::string session, int round);
 	void train();
+
+	const std::vector<RoundMetrics>& metricsPerRound() const
+	{
+		return _metricsPerRound;
+	}
 };
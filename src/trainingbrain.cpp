@@ -1,9 +1,15 @@
 #include "trainingbrain.hpp"
 
+#include <algorithm>
+
 #include "libs/lodepng/lodepng.h"
 
+#include "action.hpp"
+#include "genome.hpp"
 #include "module.hpp"
+#include "parameterarena.hpp"
 #include "stateloader.hpp"
+#include "trace.hpp"
 
 
 // We are not backpropagating, so no need for gradient calculation.
@@ -74,27 +80,67 @@ TrainingBrain::TrainingBrain(Personality p, size_t mNum, size_t fNum,
 	else _module->to(torch::kFloat);
 }
 
+TrainingBrain::TrainingBrain(const TrainingBrain& other,
+		std::shared_ptr<Module> module) :
+	_module(module),
+	personality(other.personality),
+	serialNumber(other.serialNumber),
+	motherNumber(other.motherNumber),
+	fatherNumber(other.fatherNumber),
+	genome(other.genome),
+	contentHash(other.contentHash),
+	numGames(other.numGames),
+	objectiveScore(other.objectiveScore)
+{
+	if (other.correlationTensor.defined()
+		&& other.correlationTensor.size(0) > 0)
+	{
+		correlationTensor = other.correlationTensor.clone();
+		correlationTensor2 = other.correlationTensor2.clone();
+		inputBiasTensor = other.inputBiasTensor.clone();
+		outputBiasTensor = other.outputBiasTensor.clone();
+	}
+	else
+	{
+		correlationTensor = torch::empty(0);
+	}
+}
+
 TrainingBrain::TrainingBrain(Personality personality) :
 	TrainingBrain(personality, 0, 0,
 		createModuleBasedOnPersonality(personality)
 	)
 {}
 
+TrainingBrain::TrainingBrain(Personality personality, ParameterArena& arena) :
+	TrainingBrain(personality, 0, 0,
+		isNeural(personality) ? arena.bindNew() : nullptr
+	)
+{}
+
 void TrainingBrain::reset(size_t seat)
 {
-	size_t n = numGamesPerSeat[seat] * NUM_VIEW_SETS * NUM_CARDS;
-	viewBufferPerSeat[seat].resize(n, 0);
-	viewTensorPerSeat[seat] = torch::zeros(
-			{int(numGamesPerSeat[seat]), int(NUM_VIEW_SETS * NUM_CARDS)},
-			torch::kFloat);
-	if (ENABLE_CUDA)
+	size_t n = numGamesPerSeat[seat];
+	if (viewStoragePerSeat[seat].defined()
+		&& size_t(viewStoragePerSeat[seat].size(0)) >= n)
 	{
-		viewTensorPerSeat[seat] = viewTensorPerSeat[seat].contiguous().to(
-			torch::kCUDA, torch::kHalf, /*non_blocking=*/true);
+		return;
 	}
-	outputTensorPerSeat[seat] = torch::zeros(
-			{int(numGamesPerSeat[seat]), int(ACTION_SIZE)},
+	// Leave some room so that a slightly larger batch in a later round
+	// does not need another allocation. Torch aligns CPU storage to 64 bytes.
+	// The outputs must start out as zeros, because the brains that do not
+	// evaluate leave them as is.
+	size_t capacity = n + n / 8 + 1;
+	viewStoragePerSeat[seat] = torch::zeros(
+			{int(capacity), int(NUM_VIEW_SETS * NUM_CARDS)},
+			torch::kFloat);
+	outputStoragePerSeat[seat] = torch::zeros(
+			{int(capacity), int(ACTION_SIZE)},
 			torch::kFloat);
+	viewBufferPerSeat[seat] = viewStoragePerSeat[seat].data_ptr<float>();
+	outputBufferPerSeat[seat] = outputStoragePerSeat[seat].data_ptr<float>();
+	tableCardsPerSeat[seat].resize(capacity);
+	handCardsPerSeat[seat].resize(capacity);
 }
 
 void TrainingBrain::calculateCorrelation(bool on)
@@ -125,23 +171,23 @@ void TrainingBrain::calculateCorrelation(bool on)
 				torch::kCUDA, torch::kHalf, /*non_blocking=*/true);
 		}
 	}
-	else
+	else if (!correlationTensor.defined() || correlationTensor.size(0) > 0)
 	{
 		correlationTensor = torch::empty(0);
 	}
 }
 
-void TrainingBrain::evaluate(size_t seat, size_t turn)
+void TrainingBrain::evaluate(size_t seat, size_t turn,
+	const Settings& settings)
 {
+	TRACE_SCOPE("TrainingBrain::evaluate", serialNumber);
 	if (!TrainingBrain::isNeural(personality))
 	{
 		switch (personality)
 		{
 			case Personality::DRUNK:
 			{
-				outputTensorPerSeat[seat] = torch::rand(
-					{int(numGamesPerSeat[seat]), int(ACTION_SIZE)},
-					torch::kFloat);
+				outputTensorPerSeat[seat].uniform_();
 				return;
 			}
 			break;
@@ -161,8 +207,44 @@ void TrainingBrain::evaluate(size_t seat, size_t turn)
 			"" << std::endl;
 		return;
 	}
+	// Brains without games, such as those of personalities that are never
+	// dealt in, would otherwise pack or run their weights for nothing.
+	if (numGamesPerSeat[seat] == 0)
+	{
+		return;
+	}
 
-	torch::Tensor outputTensor = _module->forward(viewTensorPerSeat[seat]);
+	torch::Tensor outputTensor;
+	if (ENABLE_CUDA)
+	{
+		outputTensor = _module->forward(viewTensorPerSeat[seat]);
+	}
+	else if (settings.legalActionsOnly && correlationTensor.size(0) == 0
+		&& (settings.inferenceKernel == InferenceKernel::FUSED
+			|| settings.inferenceKernel == InferenceKernel::QUANTIZED))
+	{
+		bool quantized =
+			(settings.inferenceKernel == InferenceKernel::QUANTIZED);
+		_module->forwardLegal(viewBufferPerSeat[seat],
+			NUM_VIEW_SETS * NUM_CARDS, numGamesPerSeat[seat],
+			tableCardsPerSeat[seat].data(), handCardsPerSeat[seat].data(),
+			outputTensorPerSeat[seat].data_ptr<float>(), ACTION_SIZE, quantized);
+		outputTensor = outputTensorPerSeat[seat];
+		if (quantized)
+		{
+			compareWithFullPrecision(seat);
+		}
+	}
+	else
+	{
+		_module->forward(viewTensorPerSeat[seat], outputTensorPerSeat[seat],
+			settings);
+		outputTensor = outputTensorPerSeat[seat];
+		if (settings.inferenceKernel == InferenceKernel::QUANTIZED)
+		{
+			compareWithFullPrecision(seat);
+		}
+	}
 
 	if (correlationTensor.size(0) > 0)
 	{
@@ -199,19 +281,55 @@ void TrainingBrain::evaluate(size_t seat, size_t turn)
 		}
 	}
 
-	outputTensorPerSeat[seat] = outputTensor.to(torch::kCPU, torch::kFloat,
-		/*non_blocking=*/true);
+	if (ENABLE_CUDA)
+	{
+		outputTensorPerSeat[seat].copy_(outputTensor);
+	}
 }
 
-void TrainingBrain::cycle(size_t seat)
+void TrainingBrain::compareWithFullPrecision(size_t seat)
 {
-	torch::Tensor bufferTensor = torch::from_blob(
-		viewBufferPerSeat[seat].data(),
+	// Only every so many rows are checked, to keep the cost down.
+	constexpr size_t SAMPLE_INTERVAL = 16;
+	constexpr size_t VIEW_SIZE = NUM_VIEW_SETS * NUM_CARDS;
+	size_t numSamples =
+		(numGamesPerSeat[seat] + SAMPLE_INTERVAL - 1) / SAMPLE_INTERVAL;
+	thread_local std::vector<float> expected;
+	expected.resize(numSamples * ACTION_SIZE);
+	_module->forwardFused(viewBufferPerSeat[seat], SAMPLE_INTERVAL * VIEW_SIZE,
+		numSamples, expected.data(), ACTION_SIZE, /*quantized=*/false);
+	for (size_t i = 0; i < numSamples; i++)
+	{
+		size_t row = i * SAMPLE_INTERVAL;
+		const float* view = &viewBufferPerSeat[seat][row * VIEW_SIZE];
+		// The outputs of games where we have passed are not used.
+		size_t selfPassOffset = (1 + NUM_SEATS + NUM_SEATS) * NUM_CARDS
+			+ NUM_SEATS;
+		if (view[selfPassOffset] > 0)
+		{
+			continue;
+		}
+		uint64_t table = cardsInView(view);
+		uint64_t hand = cardsInView(view + NUM_CARDS);
+		Action action = decodeAction(
+			&outputBufferPerSeat[seat][row * ACTION_SIZE], table, hand);
+		Action expectedAction = decodeAction(
+			&expected[i * ACTION_SIZE], table, hand);
+		numQuantizedSamples += 1;
+		if (action == expectedAction)
 		{
-			int(viewBufferPerSeat[seat].size() / (NUM_VIEW_SETS * NUM_CARDS)),
-			int(NUM_VIEW_SETS * NUM_CARDS)
-		},
-		torch::kFloat);
+			numQuantizedAgreements += 1;
+		}
+	}
+}
+
+void TrainingBrain::cycle(size_t seat)
+{
+	TRACE_SCOPE("TrainingBrain::cycle", serialNumber);
+	// These are views of the first rows of the storage, not copies.
+	int n = int(numGamesPerSeat[seat]);
+	torch::Tensor bufferTensor = viewStoragePerSeat[seat].narrow(0, 0, n);
+	outputTensorPerSeat[seat] = outputStoragePerSeat[seat].narrow(0, 0, n);
 	if (ENABLE_CUDA)
 	{
 		viewTensorPerSeat[seat] = bufferTensor.contiguous().to(
@@ -223,27 +341,148 @@ void TrainingBrain::cycle(size_t seat)
 	}
 }
 
-TrainingBrain TrainingBrain::makeMutation(double deviationFactor) const
+void TrainingBrain::addTally(const TrainingTally& tally)
+{
+	numLosses += tally.numLosses;
+	numBossLosses += tally.numBossLosses;
+	numPlayerLosses += tally.numPlayerLosses;
+	totalTurnsPlayed += tally.totalTurnsPlayed;
+	totalConfidence += tally.totalConfidence;
+	totalHandValue += tally.totalHandValue;
+	totalLosingHandValue += tally.totalLosingHandValue;
+	totalSurvivingHandValue += tally.totalSurvivingHandValue;
+	for (size_t suit = 0; suit < NUM_SUITS; suit++)
+	{
+		totalSuitCount[suit] += tally.totalSuitCount[suit];
+	}
+}
+
+std::vector<torch::Tensor> TrainingBrain::parameters() const
 {
 	if (!_module)
 	{
-		return TrainingBrain(personality);
+		return {};
 	}
-	auto newModule = std::dynamic_pointer_cast<Module>(_module->clone());
-	newModule->mutate(deviationFactor);
-	return TrainingBrain(personality, serialNumber, 0, newModule);
+	return _module->parameters();
 }
 
-TrainingBrain TrainingBrain::makeOffspringWith(const TrainingBrain& other) const
+void TrainingBrain::inheritModule(const TrainingBrain& parent)
 {
+	if (&parent == this || !parent._module)
+	{
+		return;
+	}
 	if (!_module)
 	{
-		return TrainingBrain(personality);
+		_module = std::dynamic_pointer_cast<Module>(parent._module->clone());
+		return;
+	}
+	_module->copyFrom(*(parent._module));
+}
+
+void TrainingBrain::startOver(size_t mNum, size_t fNum)
+{
+	serialNumber = ++_brainSerialNumber;
+	motherNumber = mNum;
+	fatherNumber = fNum;
+	genome = nullptr;
+	contentHash.clear();
+	numGames = 0;
+	numLosses = 0;
+	numBossLosses = 0;
+	numPlayerLosses = 0;
+	totalTurnsPlayed = 0;
+	totalConfidence = 0;
+	totalHandValue = 0;
+	totalLosingHandValue = 0;
+	totalSurvivingHandValue = 0;
+	totalSuitCount.fill(0);
+	objectiveScore = 0;
+	numQuantizedSamples = 0;
+	numQuantizedAgreements = 0;
+}
+
+void TrainingBrain::becomeMutationOf(const TrainingBrain& parent,
+	double deviationFactor, size_t round)
+{
+	uint64_t seed = (uint64_t(parent.serialNumber) << 32) | uint32_t(round);
+	inheritModule(parent);
+	if (_module)
+	{
+		_module->mutate(deviationFactor, seed);
+	}
+	std::shared_ptr<const Genome> parentGenome = parent.genome;
+	startOver(parent.serialNumber, 0);
+	if (parentGenome)
+	{
+		genome = makeMutationGenome(parentGenome, deviationFactor, seed);
 	}
-	auto newModule = std::dynamic_pointer_cast<Module>(_module->clone());
-	newModule->spliceWith(*(other._module));
-	return TrainingBrain(personality, serialNumber, other.serialNumber,
-		newModule);
+}
+
+void TrainingBrain::becomeOffspringOf(const TrainingBrain& mother,
+	const TrainingBrain& father, size_t round)
+{
+	// The mother can be this brain, so keep what we need of her first.
+	size_t mNum = mother.serialNumber;
+	std::shared_ptr<const Genome> motherGenome = mother.genome;
+	uint64_t seed = (uint64_t(mNum) << 32) | uint32_t(round);
+	inheritModule(mother);
+	if (_module && father._module)
+	{
+		_module->spliceWith(*(father._module), seed);
+	}
+	startOver(mNum, father.serialNumber);
+	if (motherGenome && father.genome)
+	{
+		genome = makeSpliceGenome(motherGenome, father.genome, seed);
+	}
+}
+
+void TrainingBrain::moveInto(ParameterArena& arena)
+{
+	if (_module)
+	{
+		arena.adopt(*_module);
+	}
+}
+
+void TrainingBrain::bindTo(ParameterArena& arena)
+{
+	if (_module)
+	{
+		arena.bind(*_module);
+	}
+}
+
+void TrainingBrain::loadFrom(const ParameterArena& arena, size_t row)
+{
+	if (_module)
+	{
+		arena.copyInto(row, *_module);
+	}
+}
+
+void TrainingBrain::restoreIdentity(size_t serial, size_t mNum, size_t fNum)
+{
+	serialNumber = serial;
+	motherNumber = mNum;
+	fatherNumber = fNum;
+	_brainSerialNumber = std::max(_brainSerialNumber, serial);
+}
+
+size_t TrainingBrain::rowIn(const ParameterArena& arena) const
+{
+	return _module ? arena.rowOf(*_module) : arena.numRows();
+}
+
+std::unique_ptr<TrainingBrain> TrainingBrain::snapshot() const
+{
+	std::shared_ptr<Module> module;
+	if (_module)
+	{
+		module = std::dynamic_pointer_cast<Module>(_module->clone());
+	}
+	return std::unique_ptr<TrainingBrain>(new TrainingBrain(*this, module));
 }
 
 void TrainingBrain::save(const std::string& filepath, bool forceCPU)
@@ -259,15 +498,6 @@ void TrainingBrain::save(const std::string& filepath, bool forceCPU)
 		return;
 	}
 
-	{
-		struct stat buffer;
-		if (stat(filepath.c_str(), &buffer) == 0)
-		{
-			std::cout << "Kept " << filepath << std::endl;
-			return;
-		}
-	}
-
 	if (forceCPU) _module->to(torch::kCPU, torch::kFloat);
 	save_state_dict(*_module, filepath);
 	if (forceCPU && ENABLE_CUDA) _module->to(torch::kCUDA, torch::kHalf);
@@ -302,6 +532,45 @@ void TrainingBrain::load(const std::string& filepath)
 	std::cout << "Loaded " << filepath << std::endl;
 }
 
+void TrainingBrain::saveGenome(const std::string& filepath)
+{
+	if (!genome)
+	{
+		std::cerr << "missing genome"
+			" for " << personalityName(personality) << serialNumber << ""
+			"" << std::endl;
+		return;
+	}
+
+	writeGenome(*genome, filepath);
+	std::cout << "Saved " << filepath << std::endl;
+}
+
+void TrainingBrain::loadGenome(const std::string& filepath)
+{
+	if (!_module)
+	{
+		if (TrainingBrain::isNeural(personality))
+		{
+			std::cerr << "missing module"
+				" for " << personalityName(personality) << serialNumber << ""
+				"" << std::endl;
+		}
+		return;
+	}
+
+	genome = readGenome(filepath);
+	if (ENABLE_CUDA) _module->to(torch::kCPU, torch::kFloat);
+	replayGenome(*genome, *_module);
+	if (ENABLE_CUDA)
+	{
+		_module->to(torch::kCUDA, torch::kHalf);
+		// The mutations on the GPU could not be replayed.
+		genome = nullptr;
+	}
+	std::cout << "Loaded " << filepath << std::endl;
+}
+
 inline uint8_t paletteIndexFromValue(float value, float multiplier)
 {
 	// Scale [-X, X] to [0, 1].
@@ -340,15 +609,6 @@ void TrainingBrain::saveScan(const std::string& filepath)
 		return;
 	}
 
-	{
-		struct stat buffer;
-		if (stat(filepath.c_str(), &buffer) == 0)
-		{
-			std::cout << "Keeping scan " << filepath << std::endl;
-			return;
-		}
-	}
-
 	int margin = 10;
 	int padding = 10;
 	int widthOfBias = 4;
@@ -500,15 +760,6 @@ void TrainingBrain::saveCorrelationScan(const std::string& filepath)
 		return;
 	}
 
-	{
-		struct stat buffer;
-		if (stat(filepath.c_str(), &buffer) == 0)
-		{
-			std::cout << "Keeping c-scan " << filepath << std::endl;
-			return;
-		}
-	}
-
 	int margin = 10;
 	int separation = 2;
 	int padding = 10;
@@ -5,8 +5,26 @@
 #include <torch/torch.h>
 
 #include "const.hpp"
+#include "settings.hpp"
 
 class Module;
+class ParameterArena;
+struct Genome;
+
+// What the games of a round add up for a brain. Each thread tallies its
+// own games separately, and these are added to the brain afterwards.
+struct TrainingTally
+{
+	int numLosses = 0;
+	int numBossLosses = 0;
+	int numPlayerLosses = 0;
+	int totalTurnsPlayed = 0;
+	float totalConfidence = 0;
+	float totalHandValue = 0;
+	float totalLosingHandValue = 0;
+	float totalSurvivingHandValue = 0;
+	std::array<float, NUM_SUITS> totalSuitCount = { 0 };
+};
 
 
 class TrainingBrain
@@ -18,15 +36,31 @@ public:
 	std::array<size_t, NUM_SEATS> numGamesPerSeat;
 	std::array<torch::Tensor, NUM_SEATS> viewTensorPerSeat;
 	std::array<torch::Tensor, NUM_SEATS> outputTensorPerSeat;
-	std::array<std::vector<float>, NUM_SEATS> viewBufferPerSeat;
+	// Long-lived storage for the views and outputs of each seat, with room
+	// for the largest batch seen so far, so rounds do not allocate.
+	std::array<torch::Tensor, NUM_SEATS> viewStoragePerSeat;
+	std::array<torch::Tensor, NUM_SEATS> outputStoragePerSeat;
+	std::array<float*, NUM_SEATS> viewBufferPerSeat = { nullptr };
+	// The outputs of each seat as rows of ACTION_SIZE floats, on the CPU,
+	// filled in by evaluate().
+	std::array<const float*, NUM_SEATS> outputBufferPerSeat = { nullptr };
+	// The cards on the table and in hand for each row of the views,
+	// which are the only cards that can be played.
+	std::array<std::vector<uint64_t>, NUM_SEATS> tableCardsPerSeat;
+	std::array<std::vector<uint64_t>, NUM_SEATS> handCardsPerSeat;
 	torch::Tensor correlationTensor;
 	torch::Tensor correlationTensor2;
 	torch::Tensor inputBiasTensor;
 	torch::Tensor outputBiasTensor;
 	const Personality personality;
-	const size_t serialNumber;
-	const size_t motherNumber;
-	const size_t fatherNumber;
+	// Not const, because culled brains are reused for new ones.
+	size_t serialNumber;
+	size_t motherNumber;
+	size_t fatherNumber;
+	// How to rebuild the weights from a checkpoint, if kept.
+	std::shared_ptr<const Genome> genome;
+	// The hash of the weights once computed, for the object store.
+	std::string contentHash;
 	int numGames = 0;
 	int numLosses = 0;
 	int numBossLosses = 0;
@@ -38,14 +72,21 @@ public:
 	float totalSurvivingHandValue = 0;
 	std::array<float, NUM_SUITS> totalSuitCount = { 0 };
 	float objectiveScore = 0;
+	// How often the int8 network picked the same action as the full one.
+	int numQuantizedSamples = 0;
+	int numQuantizedAgreements = 0;
 
 private:
 	explicit TrainingBrain(Personality personality,
 		size_t motherNumber, size_t fatherNumber,
 		std::shared_ptr<Module> module);
+	explicit TrainingBrain(const TrainingBrain& other,
+		std::shared_ptr<Module> module);
 
 public:
 	explicit TrainingBrain(Personality personality);
+	// Uses the next free row of the arena as the weights, as they are.
+	explicit TrainingBrain(Personality personality, ParameterArena& arena);
 	TrainingBrain(const TrainingBrain&) = delete;
 	TrainingBrain(TrainingBrain&& other) = default;
 	TrainingBrain& operator=(const TrainingBrain&) = delete;
@@ -58,14 +99,50 @@ public:
 	void calculateCorrelation(bool on);
 
 	void reset(size_t seat);
-	void evaluate(size_t seat, size_t turn);
+	void evaluate(size_t seat, size_t turn, const Settings& settings);
 	void cycle(size_t seat);
 
-	TrainingBrain makeMutation(double deviationFactor) const;
-	TrainingBrain makeOffspringWith(const TrainingBrain& other) const;
+private:
+	void compareWithFullPrecision(size_t seat);
+	void inheritModule(const TrainingBrain& parent);
+	void startOver(size_t motherNumber, size_t fatherNumber);
+
+public:
+
+	void addTally(const TrainingTally& tally);
+
+	// The weight and bias of each layer, or nothing if there is no module.
+	std::vector<torch::Tensor> parameters() const;
+
+	// Turns this culled brain into a new brain with a new serial number,
+	// keeping its module and buffers, so that evolving does not allocate.
+	// The weights only depend on the parents and the round.
+	void becomeMutationOf(const TrainingBrain& parent,
+		double deviationFactor, size_t round);
+	// The mother may be this brain itself.
+	void becomeOffspringOf(const TrainingBrain& mother,
+		const TrainingBrain& father, size_t round);
+
+	void moveInto(ParameterArena& arena);
+	// Makes the parameters views of the next free row, keeping its values.
+	void bindTo(ParameterArena& arena);
+	void loadFrom(const ParameterArena& arena, size_t row);
+	// Takes the identity of a saved brain, so that its offspring keep their
+	// lineage. Brains made after this get higher serial numbers.
+	void restoreIdentity(size_t serialNumber, size_t motherNumber,
+		size_t fatherNumber);
+
+	// The row of the arena that holds the parameters, or the number of rows.
+	size_t rowIn(const ParameterArena& arena) const;
+
+	// A copy of the weights, correlations and identity of this brain, which
+	// can be saved while this brain plays on.
+	std::unique_ptr<TrainingBrain> snapshot() const;
 
 	void save(const std::string& filepath, bool forceCPU = false);
 	void load(const std::string& filepath);
+	void saveGenome(const std::string& filepath);
+	void loadGenome(const std::string& filepath);
 
 	void saveScan(const std::string& filepath);
 	void saveCorrelationScan(const std::string& filepath);
@@ -0,0 +1,100 @@
+#include "workerpool.hpp"
+
+#include <string>
+
+#include "trace.hpp"
+
+
+WorkerPool::WorkerPool(size_t numThreads)
+{
+	for (size_t t = 1; t < numThreads; t++)
+	{
+		_threads.emplace_back(&WorkerPool::work, this, t);
+	}
+}
+
+WorkerPool::~WorkerPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_stopping = true;
+	}
+	_started.notify_all();
+	for (std::thread& thread : _threads)
+	{
+		thread.join();
+	}
+}
+
+void WorkerPool::run(size_t numItems, const Task& task)
+{
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_task = &task;
+		_numItems = numItems;
+		_numBusy = _threads.size();
+		_exception = nullptr;
+		_generation += 1;
+	}
+	_started.notify_all();
+
+	runRange(0);
+
+	std::unique_lock<std::mutex> lock(_mutex);
+	_finished.wait(lock, [this]() { return _numBusy == 0; });
+	_task = nullptr;
+	if (_exception)
+	{
+		std::rethrow_exception(_exception);
+	}
+}
+
+void WorkerPool::work(size_t thread)
+{
+	setTraceThreadName("worker " + std::to_string(thread));
+	size_t generation = 0;
+	while (true)
+	{
+		{
+			std::unique_lock<std::mutex> lock(_mutex);
+			_started.wait(lock, [this, generation]() {
+				return _stopping || _generation != generation;
+			});
+			if (_stopping)
+			{
+				return;
+			}
+			generation = _generation;
+		}
+
+		runRange(thread);
+
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			_numBusy -= 1;
+		}
+		_finished.notify_one();
+	}
+}
+
+void WorkerPool::runRange(size_t thread)
+{
+	size_t begin = _numItems * thread / size();
+	size_t end = _numItems * (thread + 1) / size();
+	if (begin >= end)
+	{
+		return;
+	}
+	try
+	{
+		(*_task)(begin, end, thread);
+	}
+	catch (...)
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		if (!_exception)
+		{
+			_exception = std::current_exception();
+		}
+	}
+}
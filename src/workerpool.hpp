@@ -0,0 +1,47 @@
+#pragma once
+
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+class WorkerPool
+{
+public:
+	using Task = std::function<void(size_t begin, size_t end, size_t thread)>;
+
+private:
+	std::vector<std::thread> _threads;
+	std::mutex _mutex;
+	std::condition_variable _started;
+	std::condition_variable _finished;
+	const Task* _task = nullptr;
+	size_t _numItems = 0;
+	size_t _generation = 0;
+	size_t _numBusy = 0;
+	bool _stopping = false;
+	std::exception_ptr _exception;
+
+public:
+	explicit WorkerPool(size_t numThreads);
+	WorkerPool(const WorkerPool&) = delete;
+	WorkerPool(WorkerPool&& other) = delete;
+	WorkerPool& operator=(const WorkerPool&) = delete;
+	WorkerPool& operator=(WorkerPool&&) = delete;
+	~WorkerPool();
+
+	// The number of threads that run tasks, including the calling thread.
+	size_t size() const { return _threads.size() + 1; }
+
+	// Splits [0, numItems) into one contiguous range per thread and runs
+	// the task on each range, with the calling thread taking thread 0.
+	// Returns once all ranges are done, rethrowing the first exception.
+	void run(size_t numItems, const Task& task);
+
+private:
+	void work(size_t thread);
+	void runRange(size_t thread);
+};